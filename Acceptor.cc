@@ -8,6 +8,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <error.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// backOff以后多久重新尝试accept
+static const double kAcceptRetryInterval = 0.1;
 
 static int createNonblockingOrDie()
 {
@@ -20,10 +26,15 @@ static int createNonblockingOrDie()
 }
 
 Acceptor::Acceptor(EventLoop* loop, const InetAddress& listenAddr,bool reuseport)
-    :loop_(loop)
+    :idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC))
+    , listenning_(false)
+    , edgeTriggered_(false)
+    , paused_(false)
+    , pauses_(0)
+    , backingOff_(false)
+    , loop_(loop)
     , acceptSocket_(createNonblockingOrDie())
     , acceptChannel_(loop, acceptSocket_.fd())
-    , listenning_(false)
 {
     acceptSocket_.setReuseAddr(true);
     acceptSocket_.setReusePort(reuseport);
@@ -34,45 +45,211 @@ Acceptor::Acceptor(EventLoop* loop, const InetAddress& listenAddr,bool reuseport
 
 }
 
+Acceptor::Acceptor(EventLoop* loop, int listenfd)
+    :idleFd_(::open("/dev/null", O_RDONLY | O_CLOEXEC))
+    , listenning_(false)
+    , edgeTriggered_(false)
+    , paused_(false)
+    , pauses_(0)
+    , backingOff_(false)
+    , loop_(loop)
+    , acceptSocket_(listenfd)
+    , acceptChannel_(loop, listenfd)
+{
+    // 继承来的socket和旧进程共享文件状态，旧进程可能没有设置非阻塞
+    int flags = ::fcntl(listenfd, F_GETFL, 0);
+    ::fcntl(listenfd, F_SETFL, flags | O_NONBLOCK);
+    acceptChannel_.setReadCallback(std::bind(&Acceptor::handleRead, this));
+}
+
 Acceptor::~Acceptor()
 {
+    if(backingOff_)
+    {
+        loop_->cancel(retryTimer_);
+    }
     acceptChannel_.disableAll();
     acceptChannel_.remove();
+    if(idleFd_ >= 0)
+    {
+        ::close(idleFd_);
+    }
 }
 
 void Acceptor::listen()
 {
     listenning_ = true;
     acceptSocket_.listen();
+    if(edgeTriggered_)
+    {
+        acceptChannel_.enableEdgeTriggered(false);
+    }
     // 监听acceptChannel的读事件
     acceptChannel_.enableReading();
     LOG_INFO("Acceptor::listenfd listenning %d \n",acceptSocket_.fd());
 }
 
+void Acceptor::stop()
+{
+    listenning_ = false;
+    paused_ = false;
+    if(backingOff_)
+    {
+        backingOff_ = false;
+        loop_->cancel(retryTimer_);
+    }
+    acceptChannel_.disableAll();
+    acceptChannel_.remove();
+    LOG_INFO("Acceptor::stop listenfd %d stop accepting \n", acceptSocket_.fd());
+}
+
 /*
 执行时机：listenfd有事件发生，也就是有新用户的连接了
+一直accept到EAGAIN（LT模式最多kMaxAcceptsPerEvent个），设置了newConnectionsCallback_时这一批连接一起回调
 */
 void Acceptor::handleRead()
 {
-    InetAddress peerAddr;
-    int connfd = acceptSocket_.accept(&peerAddr);
-    if(connfd >= 0)
+    int accepted = 0;
+    bool shed = false;
+    // ET模式下只有新的连接到来才会再通知，必须accept到EAGAIN
+    while(edgeTriggered_ || accepted < kMaxAcceptsPerEvent)
     {
-        if(newConnectionCallback_)
+        if(admitCallback_ && !admitCallback_(accepted_.size()))
         {
-            newConnectionCallback_(connfd,peerAddr);
+            // 暂停期间不会再有读事件，ET模式下resume重新注册时如果还有排队的连接会再通知一次
+            paused_ = true;
+            acceptChannel_.disableReading();
+            // 连接可能在设置paused_之前断开，那时resumeAccept看到的是没有暂停，这里再检查一次由自己恢复
+            if(admitCallback_(accepted_.size()))
+            {
+                paused_ = false;
+                acceptChannel_.enableReading();
+                continue;
+            }
+            pauses_.fetch_add(1, std::memory_order_relaxed);
+            LOG_INFO("Acceptor::handleRead listenfd %d pause accepting \n", acceptSocket_.fd());
+            break;
+        }
+        InetAddress peerAddr;
+        int connfd = acceptSocket_.accept(&peerAddr);
+        if(connfd >= 0)
+        {
+            ++accepted;
+            if(newConnectionsCallback_)
+            {
+                Accepted conn = { connfd, peerAddr };
+                accepted_.push_back(conn);
+            }
+            else if(newConnectionCallback_)
+            {
+                newConnectionCallback_(connfd,peerAddr);
+            }
+            else
+            {
+                ::close(connfd);
+            }
+        }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else if(errno == EINTR || errno == ECONNABORTED)
+        {
+            continue;
+        }
+        else if(errno == EMFILE || errno == ENFILE)
+        {
+            // 上次shedConnection关掉预留fd以后可能没有抢回来，这里再试一次
+            if(idleFd_ < 0)
+            {
+                idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            }
+            if(idleFd_ < 0)
+            {
+                backOff();
+                break;
+            }
+            // 没有fd可用时accept不会检查队列是否为空，要靠shedConnection判断还有没有排队的连接
+            if(shedConnection())
+            {
+                ++accepted;
+                shed = true;
+            }
+            else if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else if(errno != EINTR && errno != ECONNABORTED)
+            {
+                // 腾出来的fd被别的线程抢走了
+                backOff();
+                break;
+            }
         }
         else
         {
-            ::close(connfd);
+            LOG_ERROR("accept error:%d \n",errno);
+            backOff();
+            break;
         }
     }
-    else
+
+    if(shed)
     {
-        LOG_ERROR("accept error:%d \n",errno);
-        if(errno == EMFILE)
-        {
-            LOG_ERROR("socket is full");
-        }
+        LOG_ERROR("Acceptor::handleRead too many open files, shedding new connections \n");
+    }
+    if(!accepted_.empty())
+    {
+        newConnectionsCallback_(accepted_);
+        accepted_.clear();
+    }
+}
+
+void Acceptor::resume()
+{
+    if(paused_)
+    {
+        paused_ = false;
+        acceptChannel_.enableReading();
+        LOG_INFO("Acceptor::resume listenfd %d resume accepting \n", acceptSocket_.fd());
+    }
+}
+
+bool Acceptor::shedConnection()
+{
+    ::close(idleFd_);
+    int connfd = ::accept(acceptSocket_.fd(), nullptr, nullptr);
+    int savedErrno = errno;
+    if(connfd >= 0)
+    {
+        ::close(connfd);
+    }
+    // 别的线程可能在close和open之间用掉了fd，这时idleFd_为-1，下次EMFILE时再打开
+    idleFd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    errno = savedErrno;
+    return connfd >= 0;
+}
+
+void Acceptor::backOff()
+{
+    if(backingOff_)
+    {
+        return;
     }
-}
\ No newline at end of file
+    backingOff_ = true;
+    acceptChannel_.disableReading();
+    retryTimer_ = loop_->runAfter(kAcceptRetryInterval, std::bind(&Acceptor::retryAccept, this));
+    LOG_ERROR("Acceptor::backOff listenfd %d cannot accept, retry in %.1fs \n",
+        acceptSocket_.fd(), kAcceptRetryInterval);
+}
+
+// ET模式下重新注册读事件时如果还有排队的连接会再通知一次，不会丢掉backOff之前的边沿
+void Acceptor::retryAccept()
+{
+    backingOff_ = false;
+    // 期间被stop了，或者被admitCallback_暂停了由resume恢复
+    if(listenning_ && !paused_)
+    {
+        acceptChannel_.enableReading();
+    }
+}
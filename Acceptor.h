@@ -3,37 +3,94 @@
 #include "Socket.h"
 #include "Channel.h"
 
+#include "InetAddress.h"
+#include "TimerId.h"
+
 #include <functional>
+#include <vector>
+#include <atomic>
 
 class EventLoop;
 class Channel;
-class InetAddress;
 
 /*
 acceptor类的作用是监听新连接,用的EventLoop就是用户定义的那个baseLoop，也就是mainReactor
 */
 class Acceptor : noncopyable
 {
-    using NewConnectionCallback = std::function<void(int sockfd, const InetAddress&)>;
 public:
+    // 一次事件中accept到的一个连接
+    struct Accepted
+    {
+        int sockfd;
+        InetAddress peerAddr;
+    };
+    using NewConnectionCallback = std::function<void(int sockfd, const InetAddress&)>;
+    using NewConnectionsCallback = std::function<void(const std::vector<Accepted>&)>;
+    // 每次accept之前调用，参数是本轮已经accept还没有交给回调的连接数，返回false时暂停accept
+    using AdmitCallback = std::function<bool(size_t queued)>;
+
+    // LT模式下一次事件最多accept的连接数，剩下的下一轮poll还会通知，避免一直占着loop
+    static const int kMaxAcceptsPerEvent = 256;
+
     Acceptor(EventLoop* loop, const InetAddress& listenAddr,bool reuseport);
+    // 使用已经绑定好地址的socket（比如平滑升级时从旧进程继承的），可能已经在监听了
+    Acceptor(EventLoop* loop, int listenfd);
     ~Acceptor();
 
+    // 每accept一个连接回调一次
     void setNewConnectionCallback(const NewConnectionCallback& cb)
     {
         newConnectionCallback_ = cb;
     }
+    // 一次事件中accept到的所有连接一起回调，设置了以后不再调用newConnectionCallback_
+    void setNewConnectionsCallback(const NewConnectionsCallback& cb)
+    {
+        newConnectionsCallback_ = cb;
+    }
+
+    // 暂停accept时不再监听acceptChannel_的读事件，新连接留在内核的backlog中，直到resume
+    void setAdmitCallback(const AdmitCallback& cb) { admitCallback_ = cb; }
+    // 恢复accept，只能在loop线程调用，没有暂停时什么也不做
+    void resume();
+    // 可以在任意线程读取，和handleRead中设置paused_以后的再检查配对，都用seq_cst
+    bool paused() const { return paused_.load(); }
+    // 暂停accept的次数
+    uint64_t pauses() const { return pauses_.load(std::memory_order_relaxed); }
+
+    // ET模式下每次事件循环accept直到EAGAIN，需要在listen之前设置
+    void setEdgeTriggered(bool on) { edgeTriggered_ = on; }
 
+    EventLoop* getLoop() const { return loop_; }
+    int fd() const { return acceptSocket_.fd(); }
     bool listening() const { return listenning_; }
     void listen();
+    // 不再accept，socket保持打开（比如已经交给了新进程），只能在loop线程调用
+    void stop();
 private:
     void handleRead();
+    // fd用完时用预留的fd接下一个连接马上关掉，对端会收到FIN，而不是一直留在backlog里让LT模式空转
+    // 没有取到连接时返回false，errno是accept的错误
+    bool shedConnection();
+    // 暂时无法accept（腾不出fd等）时不再监听读事件，过一会由retryAccept重新注册
+    // 否则LT模式会一直通知空转，ET模式直接返回会丢掉这次边沿，排队的连接再也不会通知
+    void backOff();
+    void retryAccept();
     
     int listenfd_;
+    int idleFd_;    // 预留的fd，EMFILE时腾出来用
     bool listenning_;
+    bool edgeTriggered_;
+    std::atomic<bool> paused_;
+    std::atomic<uint64_t> pauses_;
+    bool backingOff_;   // 等待retryTimer_重新注册读事件
+    TimerId retryTimer_;
    
     EventLoop* loop_;
     Socket acceptSocket_;
     Channel acceptChannel_;
     NewConnectionCallback newConnectionCallback_;
+    NewConnectionsCallback newConnectionsCallback_;
+    AdmitCallback admitCallback_;
+    std::vector<Accepted> accepted_;    // 本轮accept到的连接，复用避免每次分配
 };
\ No newline at end of file
@@ -1,26 +1,177 @@
 #include "Buffer.h"
+#include "BufferPool.h"
 
 #include <errno.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYMUDUO_X86_SIMD 1
+#endif
+
+const size_t Buffer::kMaxReadSizeHint;
+const size_t Buffer::kShrinkThreshold;
+
+char Buffer::emptyStorage_[Buffer::kCheapPrepend];
+
+Buffer::Buffer(size_t initialSize, BufferPool* pool)
+    : buffer_(emptyStorage_)
+    , capacity_(kCheapPrepend)
+    , pool_(pool)
+    , initialSize_(initialSize)
+    , readerIndex_(kCheapPrepend)
+    , writerIndex_(kCheapPrepend)
+    , readSizeHint_(0)
+    , maxReadBytes_(0)
+{
+    if(pool_ == nullptr)
+    {
+        buffer_ = allocStorage(kCheapPrepend + initialSize_, &capacity_);
+    }
+}
+
+Buffer::~Buffer()
+{
+    releaseStorage();
+}
+
+Buffer::Buffer(const Buffer& rhs)
+    : Buffer(rhs.initialSize_, rhs.pool_)
+{
+    append(rhs.peek(), rhs.readableBytes());
+    readSizeHint_ = rhs.readSizeHint_;
+    maxReadBytes_ = rhs.maxReadBytes_;
+}
+
+Buffer::Buffer(Buffer&& rhs) noexcept
+    : buffer_(rhs.buffer_)
+    , capacity_(rhs.capacity_)
+    , pool_(rhs.pool_)
+    , initialSize_(rhs.initialSize_)
+    , readerIndex_(rhs.readerIndex_)
+    , writerIndex_(rhs.writerIndex_)
+    , readSizeHint_(rhs.readSizeHint_)
+    , maxReadBytes_(rhs.maxReadBytes_)
+{
+    rhs.buffer_ = emptyStorage_;
+    rhs.capacity_ = kCheapPrepend;
+    rhs.readerIndex_ = rhs.writerIndex_ = kCheapPrepend;
+}
+
+void Buffer::swap(Buffer& rhs)
+{
+    std::swap(buffer_, rhs.buffer_);
+    std::swap(capacity_, rhs.capacity_);
+    std::swap(pool_, rhs.pool_);
+    std::swap(initialSize_, rhs.initialSize_);
+    std::swap(readerIndex_, rhs.readerIndex_);
+    std::swap(writerIndex_, rhs.writerIndex_);
+    std::swap(readSizeHint_, rhs.readSizeHint_);
+    std::swap(maxReadBytes_, rhs.maxReadBytes_);
+}
+
+char* Buffer::allocStorage(size_t size, size_t* capacity)
+{
+    if(pool_)
+    {
+        return pool_->allocate(size, capacity);
+    }
+    *capacity = size;
+    return static_cast<char*>(::operator new(size));
+}
+
+void Buffer::releaseStorage()
+{
+    if(!hasStorage())
+    {
+        return;
+    }
+    if(pool_)
+    {
+        pool_->deallocate(buffer_, capacity_);
+    }
+    else
+    {
+        ::operator delete(buffer_);
+    }
+    buffer_ = emptyStorage_;
+    capacity_ = kCheapPrepend;
+}
+
+void Buffer::makeSpace(size_t len)
+{
+    size_t readable = readableBytes();
+    if(hasStorage() && prependableBytes() - kCheapPrepend + writeableBytes() >= len)
+    {
+        // 1.移动可读数据，2.移动可写下标 
+        // char*是天然的随机访问迭代器，符合++ -- 的操作，可以使用std::copy函数
+        std::copy(begin()+readerIndex_,
+                    begin() + writerIndex_,
+                    begin() + kCheapPrepend);
+    }
+    else
+    {
+        // 所有可用于写操作的空间都不足以写下len长度的数据，重新分配存储，已有存储至少翻倍，第一次至少initialSize_
+        size_t size = kCheapPrepend + readable + len;
+        size = std::max(size, hasStorage() ? capacity_ * 2 : kCheapPrepend + initialSize_);
+        size_t capacity = 0;
+        char* storage = allocStorage(size, &capacity);
+        std::copy(begin() + readerIndex_, begin() + writerIndex_, storage + kCheapPrepend);
+        releaseStorage();
+        buffer_ = storage;
+        capacity_ = capacity;
+    }
+    readerIndex_ = kCheapPrepend;
+    writerIndex_ = readerIndex_ + readable;
+}
+
+void Buffer::shrinkIfIdle()
+{
+    if(readableBytes() == 0 && capacity_ > kShrinkThreshold
+        && capacity_ / 2 > kCheapPrepend + std::max(initialSize_, readSizeHint_))
+    {
+        // 突发数据撑大的存储还给pool，下次写入时按需要的大小重新分配
+        retrieveAll();
+        releaseStorage();
+    }
+}
+
+// 每个线程一块64K的溢出缓冲区，只在一次读到的数据超过Buffer剩余空间时用到，
+// 不需要每次readFd都在栈上开辟并清零64K（小消息也要付出memset和缓存污染的代价）
+// 为什么是64K数据？参考：https://sp9qtxrfps.feishu.cn/wiki/LZY9wGaoSiCOFekYN3xcuyXtn7e?wiki_all_space_view_source=space_sidebar&fromScene=spaceOverview
+static __thread char t_extraBuf[65536];
+
 /*
 * 从fd上读取数据，Poller是工作在LT模式下的
 * Buffer缓冲区是由大小的，但是从fd上读取数据的时候，不知道tcp数据的大小
 */
 ssize_t Buffer::readFd(int fd,int* saveErrno)
 {
-    char extraBuf[65536] = {0}; // 从栈内存开辟64K大小的数据  为什么是64K数据？参考：https://sp9qtxrfps.feishu.cn/wiki/LZY9wGaoSiCOFekYN3xcuyXtn7e?wiki_all_space_view_source=space_sidebar&fromScene=spaceOverview
+    shrinkIfIdle();
+    // 按照最近的突发大小预留空间，让数据直接读进Buffer，不用再从t_extraBuf拷贝一次
+    // 还没有分配存储时至少预留initialSize_
+    size_t reserve = hasStorage() ? readSizeHint_ : std::max(readSizeHint_, initialSize_);
+    if(reserve > writeableBytes())
+    {
+        ensureWriteableBytes(reserve);
+    }
+
     struct iovec vec[2];
     const size_t writeable = writeableBytes(); // 这是Buffer底层缓冲区剩余的可写空间大小
+    size_t limit = writeable + sizeof t_extraBuf;
+    if(maxReadBytes_ > 0 && maxReadBytes_ < limit)
+    {
+        limit = maxReadBytes_;
+    }
     vec[0].iov_base = beginWrite();
-    vec[0].iov_len = writeable;
+    vec[0].iov_len = std::min(writeable, limit);
 
-    vec[1].iov_base = extraBuf;
-    vec[1].iov_len = sizeof extraBuf;
+    vec[1].iov_base = t_extraBuf;
+    vec[1].iov_len = limit - vec[0].iov_len;
 
-    // 如果缓冲区剩余空间大于64K，就不需要使用extraBuf
-    const int iovcnt = (writeable < sizeof extraBuf ? 2 : 1);
+    // 如果缓冲区剩余空间大于64K（或者大于读取上限），就不需要使用t_extraBuf
+    const int iovcnt = (writeable < sizeof t_extraBuf && vec[1].iov_len > 0 ? 2 : 1);
     const ssize_t n = ::readv(fd,vec,iovcnt);
     if(n < 0)
     {
@@ -34,13 +185,40 @@ ssize_t Buffer::readFd(int fd,int* saveErrno)
     else
     {
         // 写入了两块空间
-        writerIndex_ = buffer_.size();  // Buffer中已经写满了
-        append(extraBuf,n - writeable); // writerIndex_开始写 n - writable大小的数据,其中append中有扩容操作
+        writerIndex_ = capacity_;  // Buffer中已经写满了
+        append(t_extraBuf,n - writeable); // writerIndex_开始写 n - writable大小的数据,其中append中有扩容操作
     }
 
+    if(n > 0)
+    {
+        adjustReadSizeHint(n, writeable);
+    }
     return n;
 }
 
+void Buffer::adjustReadSizeHint(size_t n, size_t writeable)
+{
+    if(n > writeable)
+    {
+        // 用到了溢出缓冲区，说明突发数据比预留的空间大，下次按2的幂向上预留
+        size_t hint = readSizeHint_ > 0 ? readSizeHint_ : kInitialSize;
+        while(hint < n && hint < kMaxReadSizeHint)
+        {
+            hint *= 2;
+        }
+        readSizeHint_ = std::min(hint, kMaxReadSizeHint);
+    }
+    else if(n < readSizeHint_ / 4)
+    {
+        // 数据明显变小了，逐步减小预留，小消息不再占用大块空间
+        readSizeHint_ /= 2;
+        if(readSizeHint_ < kInitialSize)
+        {
+            readSizeHint_ = 0;
+        }
+    }
+}
+
 ssize_t Buffer::writeFd(int fd, int* saveErrno)
 {
     ssize_t n = ::write(fd,peek(),readableBytes());
@@ -49,4 +227,103 @@ ssize_t Buffer::writeFd(int fd, int* saveErrno)
         *saveErrno = errno;
     }
     return n;
-}
\ No newline at end of file
+}
+namespace
+{
+
+using ScanFunc = const char* (*)(const char* begin, const char* end, char c);
+
+const char* scanByteScalar(const char* begin, const char* end, char c)
+{
+    for(const char* p = begin; p < end; ++p)
+    {
+        if(*p == c)
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+#ifdef MYMUDUO_X86_SIMD
+// x86-64上SSE2总是可用的，一次比较16个字节，不对齐读取，剩下不足16个字节的逐字节找
+__attribute__((target("sse2")))
+const char* scanByteSse2(const char* begin, const char* end, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    const char* p = begin;
+    for(; end - p >= 16; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if(mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return scanByteScalar(p, end, c);
+}
+
+__attribute__((target("avx2")))
+const char* scanByteAvx2(const char* begin, const char* end, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    const char* p = begin;
+    for(; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+        if(mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return scanByteSse2(p, end, c);
+}
+#endif
+
+// 进程启动的时候根据CPU选择一次实现
+ScanFunc chooseScanByte()
+{
+#ifdef MYMUDUO_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        return scanByteAvx2;
+    }
+    if(__builtin_cpu_supports("sse2"))
+    {
+        return scanByteSse2;
+    }
+#endif
+    return scanByteScalar;
+}
+
+const ScanFunc scanByte = chooseScanByte();
+
+} // namespace
+
+const char* Buffer::findByte(char c, const char* start) const
+{
+    return scanByte(start, beginWrite(), c);
+}
+
+const char* Buffer::findCRLF(const char* start) const
+{
+    const char* end = beginWrite();
+    // 先找'\r'，后面紧跟'\n'才算找到，否则从下一个字节继续找
+    while(start < end)
+    {
+        const char* cr = scanByte(start, end, '\r');
+        if(cr == nullptr || cr + 1 >= end)
+        {
+            return nullptr;
+        }
+        if(cr[1] == '\n')
+        {
+            return cr;
+        }
+        start = cr + 1;
+    }
+    return nullptr;
+}
@@ -3,6 +3,13 @@
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <sys/types.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+class BufferPool;
 
 // 网络库底层的缓冲器类型
 class Buffer 
@@ -10,12 +17,21 @@ class Buffer
 public:
     static const size_t kCheapPrepend = 8;
     static const size_t kInitialSize = 1024;
+    static const size_t kMaxReadSizeHint = 1024 * 1024;  // 自适应读取预留空间的上限
+    static const size_t kShrinkThreshold = 64 * 1024;    // 数据取完以后，超过这个大小的存储会被释放
+
+    // 不指定pool时在构造的时候分配存储；指定pool时第一次写入才从pool中分配，空闲的连接不占用缓冲区内存
+    explicit Buffer(size_t initialSize = kInitialSize, BufferPool* pool = nullptr);
+    ~Buffer();
 
-    explicit Buffer(size_t initialSize = kInitialSize)
-                : buffer_(kCheapPrepend + initialSize)
-                , readerIndex_(kCheapPrepend)
-                , writerIndex_(kCheapPrepend)
-                {}
+    Buffer(const Buffer& rhs);
+    Buffer(Buffer&& rhs) noexcept;
+    Buffer& operator=(Buffer rhs)
+    {
+        swap(rhs);
+        return *this;
+    }
+    void swap(Buffer& rhs);
     
      // 可读空间字节
     size_t readableBytes() const
@@ -26,7 +42,7 @@ public:
     // 可写空间字节
     size_t writeableBytes() const
     {
-        return buffer_.size() - writerIndex_;
+        return capacity_ - writerIndex_;
     }
 
     // 预留空间字节
@@ -38,7 +54,7 @@ public:
     // 返回缓冲区可读数据的起始地址
     const char* peek() const
     {
-        return &*buffer_.begin() + readerIndex_;
+        return begin() + readerIndex_;
     } 
 
     // OnMessage触发时，用户读取一部分数据len长度，需要将readerIndex_复位到正确的位置
@@ -59,6 +75,11 @@ public:
         readerIndex_ = writerIndex_ = kCheapPrepend;
     }
 
+    void retrieveInt64() { retrieve(sizeof(int64_t)); }
+    void retrieveInt32() { retrieve(sizeof(int32_t)); }
+    void retrieveInt16() { retrieve(sizeof(int16_t)); }
+    void retrieveInt8() { retrieve(sizeof(int8_t)); }
+
     // 把onMessage函数上报的Buffer数据，转成string类型的数据返回
     std::string retrieveAllAsString()
     {
@@ -71,7 +92,19 @@ public:
         retrieve(len);   // 上面一句把缓冲区中可读的数据，已经读取出来，这里肯定要对缓冲区进行复位操作
         return result;
     }
-    // 确保有len长度的空间是可以写入buffer的   buffer_.size() - writerIndex 与len的关系主要判断  
+    // 在可读数据中查找，找到返回位置，没有找到返回nullptr
+    // 带start参数的版本从start开始查找，start必须在[peek(), beginWrite()]之间
+    // x86上用SSE2/AVX2一次比较16/32个字节，其他平台逐字节查找
+    const char* findByte(char c) const { return findByte(c, peek()); }
+    const char* findByte(char c, const char* start) const;
+    // 查找"\r\n"，返回'\r'的位置
+    const char* findCRLF() const { return findCRLF(peek()); }
+    const char* findCRLF(const char* start) const;
+    // 查找'\n'
+    const char* findEOL() const { return findByte('\n', peek()); }
+    const char* findEOL(const char* start) const { return findByte('\n', start); }
+
+    // 确保有len长度的空间是可以写入buffer的   capacity_ - writerIndex 与len的关系主要判断  
     void ensureWriteableBytes(size_t len)
     {
         if(writeableBytes() < len)
@@ -85,6 +118,128 @@ public:
     {
         ensureWriteableBytes(len);
         std::copy(data,data+len,beginWrite());
+        writerIndex_ += len;
+    }
+
+    void append(const void* data, size_t len)
+    {
+        append(static_cast<const char*>(data), len);
+    }
+
+    // 按网络字节序（大端）追加整数
+    void appendInt64(int64_t x)
+    {
+        int64_t be64 = htobe64(x);
+        append(&be64, sizeof be64);
+    }
+
+    void appendInt32(int32_t x)
+    {
+        int32_t be32 = htobe32(x);
+        append(&be32, sizeof be32);
+    }
+
+    void appendInt16(int16_t x)
+    {
+        int16_t be16 = htobe16(x);
+        append(&be16, sizeof be16);
+    }
+
+    void appendInt8(int8_t x)
+    {
+        append(&x, sizeof x);
+    }
+
+    // 按网络字节序读取整数并从缓冲区中取走，需要保证readableBytes()足够
+    int64_t readInt64()
+    {
+        int64_t result = peekInt64();
+        retrieveInt64();
+        return result;
+    }
+
+    int32_t readInt32()
+    {
+        int32_t result = peekInt32();
+        retrieveInt32();
+        return result;
+    }
+
+    int16_t readInt16()
+    {
+        int16_t result = peekInt16();
+        retrieveInt16();
+        return result;
+    }
+
+    int8_t readInt8()
+    {
+        int8_t result = peekInt8();
+        retrieveInt8();
+        return result;
+    }
+
+    // 按网络字节序读取整数，不取走，需要保证readableBytes()足够
+    int64_t peekInt64() const
+    {
+        int64_t be64 = 0;
+        ::memcpy(&be64, peek(), sizeof be64);
+        return be64toh(be64);
+    }
+
+    int32_t peekInt32() const
+    {
+        int32_t be32 = 0;
+        ::memcpy(&be32, peek(), sizeof be32);
+        return be32toh(be32);
+    }
+
+    int16_t peekInt16() const
+    {
+        int16_t be16 = 0;
+        ::memcpy(&be16, peek(), sizeof be16);
+        return be16toh(be16);
+    }
+
+    int8_t peekInt8() const
+    {
+        return *peek();
+    }
+
+    // 在可读数据的前面插入数据，用的是kCheapPrepend预留的空间，需要保证prependableBytes()足够
+    // 比如先把消息体写进Buffer，最后再把长度头写在前面，不需要拼接一个新的缓冲区
+    void prepend(const void* data, size_t len)
+    {
+        assert(len <= prependableBytes());
+        if(!hasStorage())
+        {
+            makeSpace(0);   // 预留区域也要先分配存储
+        }
+        readerIndex_ -= len;
+        ::memcpy(begin() + readerIndex_, data, len);
+    }
+
+    void prependInt64(int64_t x)
+    {
+        int64_t be64 = htobe64(x);
+        prepend(&be64, sizeof be64);
+    }
+
+    void prependInt32(int32_t x)
+    {
+        int32_t be32 = htobe32(x);
+        prepend(&be32, sizeof be32);
+    }
+
+    void prependInt16(int16_t x)
+    {
+        int16_t be16 = htobe16(x);
+        prepend(&be16, sizeof be16);
+    }
+
+    void prependInt8(int8_t x)
+    {
+        prepend(&x, sizeof x);
     }
 
     char* beginWrite()
@@ -99,40 +254,49 @@ public:
 
     // 从fd上读取数据
     ssize_t readFd(int fd,int* saveErrno);
+    // 限制一次readFd最多读取的字节数，0表示不限制（最多Buffer剩余空间+64K）
+    void setMaxReadBytes(size_t maxBytes) { maxReadBytes_ = maxBytes; }
+    size_t maxReadBytes() const { return maxReadBytes_; }
+    // 下一次readFd之前会预留的可写空间，根据最近读到的数据量自适应调整
+    size_t readSizeHint() const { return readSizeHint_; }
     // 向fd上写数据
     ssize_t writeFd(int fd,int* saveErrno);
+
+    // 数据已经取完，并且存储比最近需要的大很多（超过kShrinkThreshold）时，把存储还给pool
+    void shrinkIfIdle();
+    // 当前存储的大小，包括kCheapPrepend
+    size_t capacity() const { return capacity_; }
     
 private:
+    // 根据本次readFd读到的数据量调整readSizeHint_
+    void adjustReadSizeHint(size_t n, size_t writeable);
+
     char* begin()
     {
-        return &*buffer_.begin();
+        return buffer_;
     }
 
     const char* begin() const
     {
-        return &*buffer_.begin();
+        return buffer_;
     }
 
+    bool hasStorage() const { return buffer_ != emptyStorage_; }
+    // 分配/释放存储，有pool时走pool
+    char* allocStorage(size_t size, size_t* capacity);
+    void releaseStorage();
+
     // 扩容函数
-    void makeSpace(size_t len)
-    {
-        if(prependableBytes() - kCheapPrepend + writeableBytes() < len)
-        {
-            // 所有可用于写操作的空间都不足以写下len长度的数据,直接扩容len长度
-            buffer_.resize(writerIndex_ + len);
-        }
-        else
-        {
-            // 1.移动可读数据，2.移动可写下标 
-            // char*是天然的随机访问迭代器，符合++ -- 的操作，可以使用std::copy函数
-            std::copy(begin()+readerIndex_,
-                        begin() + writerIndex_,
-                        begin() + kCheapPrepend);
-            readerIndex_ =  kCheapPrepend;
-            writerIndex_ = kCheapPrepend + readableBytes();
-        }
-    }
-    std::vector<char> buffer_;   // 存储数据
+    void makeSpace(size_t len);
+
+    static char emptyStorage_[kCheapPrepend];  // 还没有分配存储的Buffer都指向这里，只读
+
+    char* buffer_;              // 存储数据
+    size_t capacity_;           // buffer_的大小
+    BufferPool* pool_;          // 存储从这里分配，可以为空
+    size_t initialSize_;        // 第一次分配存储时的可写空间大小
     size_t readerIndex_;        // 可读空间起始值   
     size_t writerIndex_;       // 可写空间起始值
+    size_t readSizeHint_;      // readFd之前预留的可写空间，跟随突发数据的大小增长，数据变小以后缓慢回落
+    size_t maxReadBytes_;      // 一次readFd最多读取的字节数，0表示不限制
 };
\ No newline at end of file
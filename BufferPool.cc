@@ -0,0 +1,125 @@
+#include "BufferPool.h"
+#include "CurrentThread.h"
+
+#include <new>
+
+const size_t BufferPool::kMinBlockSize;
+const size_t BufferPool::kMaxBlockSize;
+const int BufferPool::kNumClasses;
+const size_t BufferPool::kMaxCachedBytes;
+const size_t BufferPool::kIdleCachedBytes;
+
+BufferPool::BufferPool()
+    : threadId_(CurrentThread::tid())
+    , hits_(0)
+    , misses_(0)
+    , residentBytes_(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for(int i = 0; i < kNumClasses; ++i)
+    {
+        for(char* data : freeLists_[i])
+        {
+            ::operator delete(data);
+        }
+    }
+}
+
+bool BufferPool::isInPoolThread() const
+{
+    return threadId_ == CurrentThread::tid();
+}
+
+// 第0级是1024，之后每个2的幂[2^k, 2^(k+1))分成4级
+int BufferPool::classOf(size_t size)
+{
+    if(size <= kMinBlockSize)
+    {
+        return 0;
+    }
+    size_t s = size - 1;
+    int msb = 63 - __builtin_clzll(s);
+    size_t base = static_cast<size_t>(1) << msb;
+    int step = static_cast<int>((s - base) / (base / 4));
+    return (msb - 10) * 4 + step + 1;
+}
+
+size_t BufferPool::classSize(int idx)
+{
+    if(idx == 0)
+    {
+        return kMinBlockSize;
+    }
+    size_t base = static_cast<size_t>(1) << (10 + (idx - 1) / 4);
+    return base + ((idx - 1) % 4 + 1) * (base / 4);
+}
+
+size_t BufferPool::roundUp(size_t size)
+{
+    return size > kMaxBlockSize ? size : classSize(classOf(size));
+}
+
+char* BufferPool::allocate(size_t size, size_t* capacity)
+{
+    if(size > kMaxBlockSize)
+    {
+        *capacity = size;
+        return static_cast<char*>(::operator new(size));
+    }
+
+    int idx = classOf(size);
+    *capacity = classSize(idx);
+    if(isInPoolThread())
+    {
+        std::vector<char*>& freeList = freeLists_[idx];
+        if(!freeList.empty())
+        {
+            char* data = freeList.back();
+            freeList.pop_back();
+            add(hits_, static_cast<uint64_t>(1));
+            residentBytes_.store(residentBytes() - *capacity, std::memory_order_relaxed);
+            return data;
+        }
+        add(misses_, static_cast<uint64_t>(1));
+    }
+    return static_cast<char*>(::operator new(*capacity));
+}
+
+void BufferPool::deallocate(char* data, size_t capacity)
+{
+    if(capacity <= kMaxBlockSize
+        && isInPoolThread()
+        && residentBytes() + capacity <= kMaxCachedBytes)
+    {
+        int idx = classOf(capacity);
+        if(classSize(idx) == capacity)
+        {
+            freeLists_[idx].push_back(data);
+            add(residentBytes_, capacity);
+            return;
+        }
+    }
+    ::operator delete(data);
+}
+
+void BufferPool::trim(size_t keepBytes)
+{
+    for(int idx = kNumClasses - 1; idx >= 0 && residentBytes() > keepBytes; --idx)
+    {
+        std::vector<char*>& freeList = freeLists_[idx];
+        const size_t size = classSize(idx);
+        while(!freeList.empty() && residentBytes() > keepBytes)
+        {
+            ::operator delete(freeList.back());
+            freeList.pop_back();
+            residentBytes_.store(residentBytes() - size, std::memory_order_relaxed);
+        }
+        if(freeList.empty())
+        {
+            std::vector<char*>().swap(freeList);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+* 每个EventLoop一个的Buffer存储池，按大小分级缓存释放的内存块
+* 1K~4M之间每个2的幂再分成4级（1024,1280,1536,1792,2048,2560...），浪费不超过25%，超过4M的直接走堆
+* 只在所属loop线程中使用缓存，其他线程（比如mainLoop构造TcpConnection）分配/释放直接走堆，不加锁
+* 统计数据可以在任意线程读取
+*/
+class BufferPool : noncopyable
+{
+public:
+    static const size_t kMinBlockSize = 1024;
+    static const size_t kMaxBlockSize = 4 * 1024 * 1024;
+    static const int kNumClasses = 49;
+    static const size_t kMaxCachedBytes = 32 * 1024 * 1024;  // 每个池最多缓存的字节数
+    static const size_t kIdleCachedBytes = 1024 * 1024;      // loop空闲时缓存收缩到这个大小
+
+    BufferPool();
+    ~BufferPool();
+
+    // 分配至少size字节，*capacity返回实际可用的大小
+    char* allocate(size_t size, size_t* capacity);
+    // capacity必须是allocate返回的大小
+    void deallocate(char* data, size_t capacity);
+    // 释放缓存的内存块，直到缓存的字节数不超过keepBytes，大块优先释放，只能在loop线程调用
+    void trim(size_t keepBytes);
+
+    // 从缓存中分配成功/失败的次数，以及当前缓存的字节数
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+    size_t residentBytes() const { return residentBytes_.load(std::memory_order_relaxed); }
+
+    // size向上取整到所属的级别，超过kMaxBlockSize的原样返回
+    static size_t roundUp(size_t size);
+
+private:
+    static int classOf(size_t size);
+    static size_t classSize(int idx);
+
+    bool isInPoolThread() const;
+
+    // 只有loop线程写，用load+store代替原子的读-改-写
+    template<typename T>
+    static void add(std::atomic<T>& counter, T delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    const pid_t threadId_;  // 所属loop的线程
+    std::vector<char*> freeLists_[kNumClasses];
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<size_t> residentBytes_;
+};
@@ -13,4 +13,5 @@ using MessageCallback = std::function<void(const TcpConnectionPtr&, Buffer*,Time
 using WriteCompleteCallback = std::function<void(const TcpConnectionPtr&)>;
 using CloseCallback = std::function<void(const TcpConnectionPtr&)>;
 
-using HighWaterMarkCallback = std::function<void (const TcpConnectionPtr&, size_t)>;
\ No newline at end of file
+using HighWaterMarkCallback = std::function<void (const TcpConnectionPtr&, size_t)>;
+using TimerCallback = std::function<void()>;
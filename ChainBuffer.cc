@@ -0,0 +1,126 @@
+#include "ChainBuffer.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <algorithm>
+
+const size_t ChainBuffer::kBlockSize;
+const size_t ChainBuffer::kMaxSpareBlocks;
+
+ChainBuffer::ChainBuffer()
+    : readable_(0)
+{
+}
+
+ChainBuffer::~ChainBuffer()
+{
+    for(const Block& block : blocks_)
+    {
+        delete[] block.data;
+    }
+    for(char* data : spare_)
+    {
+        delete[] data;
+    }
+}
+
+char* ChainBuffer::allocBlock()
+{
+    if(!spare_.empty())
+    {
+        char* data = spare_.back();
+        spare_.pop_back();
+        return data;
+    }
+    return new char[kBlockSize];
+}
+
+void ChainBuffer::freeBlock(char* data)
+{
+    if(spare_.size() < kMaxSpareBlocks)
+    {
+        spare_.push_back(data);
+    }
+    else
+    {
+        delete[] data;
+    }
+}
+
+void ChainBuffer::append(const char* data, size_t len)
+{
+    readable_ += len;
+    while(len > 0)
+    {
+        if(blocks_.empty() || blocks_.back().writerIndex == kBlockSize)
+        {
+            Block block = { allocBlock(), 0, 0 };
+            blocks_.push_back(block);
+        }
+        Block& tail = blocks_.back();
+        size_t n = std::min(len, kBlockSize - tail.writerIndex);
+        memcpy(tail.data + tail.writerIndex, data, n);
+        tail.writerIndex += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void ChainBuffer::retrieve(size_t len)
+{
+    if(len >= readable_)
+    {
+        retrieveAll();
+        return;
+    }
+
+    readable_ -= len;
+    while(len > 0)
+    {
+        Block& head = blocks_.front();
+        size_t n = std::min(len, head.writerIndex - head.readerIndex);
+        head.readerIndex += n;
+        len -= n;
+        if(head.readerIndex == head.writerIndex && head.writerIndex == kBlockSize)
+        {
+            // 写满并且发送完的块才回收，最后一个块还可以继续追加
+            freeBlock(head.data);
+            blocks_.pop_front();
+        }
+    }
+}
+
+void ChainBuffer::retrieveAll()
+{
+    for(const Block& block : blocks_)
+    {
+        freeBlock(block.data);
+    }
+    blocks_.clear();
+    readable_ = 0;
+}
+
+ssize_t ChainBuffer::writeFd(int fd, int* saveErrno)
+{
+    struct iovec vec[IOV_MAX];
+    int iovcnt = 0;
+    for(std::deque<Block>::const_iterator it = blocks_.begin();
+        it != blocks_.end() && iovcnt < IOV_MAX; ++it)
+    {
+        if(it->writerIndex > it->readerIndex)
+        {
+            vec[iovcnt].iov_base = it->data + it->readerIndex;
+            vec[iovcnt].iov_len = it->writerIndex - it->readerIndex;
+            ++iovcnt;
+        }
+    }
+
+    ssize_t n = ::writev(fd, vec, iovcnt);
+    if(n < 0)
+    {
+        *saveErrno = errno;
+    }
+    return n;
+}
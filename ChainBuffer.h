@@ -0,0 +1,55 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <sys/types.h>
+
+/*
+* 由固定大小数据块串起来的发送缓冲区
+* Buffer是一块连续内存，积压的数据很多时，扩容需要把已有数据整体拷贝一遍，retrieve之后的makeSpace也要挪动数据
+* ChainBuffer追加数据只会写到最后一个块（写满了就挂一个新块），已有的数据永远不会被移动，追加是O(1)的（不算拷贝本身）
+* 发送时用writev把各个块一次性交给内核，发送完的块放回空闲链表复用
+*/
+class ChainBuffer : noncopyable
+{
+public:
+    static const size_t kBlockSize = 16 * 1024;  // 每个数据块的大小
+    static const size_t kMaxSpareBlocks = 4;     // 最多缓存多少个空闲块，多余的直接释放
+
+    ChainBuffer();
+    ~ChainBuffer();
+
+    // 可读（待发送）的字节数
+    size_t readableBytes() const { return readable_; }
+    // 当前挂着的数据块个数
+    size_t numBlocks() const { return blocks_.size(); }
+
+    // 追加数据，写满当前块以后挂新的块
+    void append(const char* data, size_t len);
+    void append(const std::string& str) { append(str.data(), str.size()); }
+
+    // 丢弃前len个字节，整块发送完的数据块会被回收
+    void retrieve(size_t len);
+    void retrieveAll();
+
+    // 把所有块组织成iovec，用writev一次写出去，最多IOV_MAX个块
+    ssize_t writeFd(int fd, int* saveErrno);
+
+private:
+    struct Block
+    {
+        char* data;
+        size_t readerIndex;
+        size_t writerIndex;
+    };
+
+    char* allocBlock();
+    void freeBlock(char* data);
+
+    std::deque<Block> blocks_;   // 存放数据的块，front是最早写入的
+    std::vector<char*> spare_;   // 空闲的数据块
+    size_t readable_;            // 所有块中可读数据的总和
+};
@@ -7,10 +7,11 @@
 const int Channel::kNoneEvent = 0;
 const int Channel::kReadEvent = EPOLLIN | EPOLLPRI;
 const int Channel::kWriteEvent = EPOLLOUT;
+const int Channel::kEdgeTriggered = EPOLLET;
 
 // EventLoop（一个事件循环，一个线程中） 包含多个Channel和一个Poller
 Channel::Channel(EventLoop *loop, int fd)
-    : loop_(loop), fd_(fd), events_(0), revents_(0), index_(-1), tied_(false)
+    : loop_(loop), fd_(fd), events_(0), registeredEvents_(kNoneEvent), revents_(0), index_(-1), tied_(false)
 {
 }
 
@@ -29,8 +30,14 @@ void Channel::tie(const std::shared_ptr<void>& obj)
 */
 void Channel::update()
 {
+    // 感兴趣的事件没有变化，不需要再调用一次epoll_ctl
+    if(events_ == registeredEvents_)
+    {
+        return;
+    }
+    registeredEvents_ = events_;
+
     // 通过channel所属的EventLoop,调用poller的相应方法，注册fd的events事件
-    // add code todo
     loop_->updateChannel(this);
 }
 
@@ -40,6 +47,7 @@ void Channel::update()
 void Channel::remove()
 {
     loop_->removeChannel(this);
+    registeredEvents_ = kNoneEvent;
 }
 
 // fd得到poller的通知以后，处理相应的事件
@@ -2,6 +2,7 @@
 
 #include "noncopyable.h"
 #include "TimeStamp.h"
+#include "SmallFunction.h"
 
 #include <functional>
 #include <memory>
@@ -16,9 +17,9 @@ class Channel : noncopyable
 {
 public:
     // 事件回调
-    using EventCallBack = std::function<void()>;
+    using EventCallBack = SmallFunction<void()>;
     // 只读事件回调
-    using ReadEventCallBack = std::function<void(TimeStamp)>;
+    using ReadEventCallBack = SmallFunction<void(TimeStamp)>;
 
     Channel(EventLoop *loop, int fd);
     ~Channel();
@@ -45,11 +46,15 @@ public:
     void enableWriting(){ events_ |= kWriteEvent; update(); }
     void disableWriting(){ events_ &= ~kWriteEvent; update(); }
     void disableAll() { events_ = kNoneEvent; update(); }
+    // 切换到ET模式，只在下一次update时生效
+    // withWrite为true时EPOLLOUT在整个生命周期内保持注册（连接），监听socket不需要写事件
+    void enableEdgeTriggered(bool withWrite) { events_ |= kEdgeTriggered | (withWrite ? kWriteEvent : 0); }
 
     // 返回fd当前的事件状态
     bool isNoneEvent() const { return events_ == kNoneEvent; }
     bool isWriting() const { return events_ & kWriteEvent; }
     bool isReading() const { return events_ == kReadEvent; }
+    bool isEdgeTriggered() const { return events_ & kEdgeTriggered; }
 
     int index() {return index_;}
     void set_index(int idx) {index_ = idx;}
@@ -66,10 +71,12 @@ private:
     static const int kNoneEvent;
     static const int kReadEvent;
     static const int kWriteEvent;
+    static const int kEdgeTriggered;
 
     EventLoop *loop_; // 事件循环
     const int fd_;    // fd,poller监听的对象
     int events_;      // 注册fd感兴趣的事件
+    int registeredEvents_;  // 上一次通过update提交给poller的事件，没有变化就不再调用epoll_ctl
     int revents_;     // poller返回的具体发生的事件
     int index_;
 
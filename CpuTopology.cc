@@ -0,0 +1,241 @@
+#include "CpuTopology.h"
+#include "Logger.h"
+
+#include <sched.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <algorithm>
+#include <fstream>
+
+static std::string readLine(const std::string& path)
+{
+    std::ifstream in(path.c_str());
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+CpuTopology::CpuTopology()
+    : numNodes_(1)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(::sched_getaffinity(0, sizeof set, &set) == 0)
+    {
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if(CPU_ISSET(cpu, &set))
+            {
+                cpus_.push_back(cpu);
+            }
+        }
+    }
+    if(cpus_.empty())
+    {
+        cpus_.push_back(0);
+    }
+
+    const int maxCpu = cpus_.back();
+    nodeOfCpu_.assign(maxCpu + 1, 0);
+    coreOfCpu_.resize(maxCpu + 1);
+    for(int cpu = 0; cpu <= maxCpu; ++cpu)
+    {
+        coreOfCpu_[cpu] = cpu;
+    }
+
+    // 每个节点目录下的cpulist，节点号可能不连续
+    std::vector<bool> usedNodes;
+    if(DIR* dir = ::opendir("/sys/devices/system/node"))
+    {
+        while(struct dirent* entry = ::readdir(dir))
+        {
+            int node = 0;
+            if(sscanf(entry->d_name, "node%d", &node) != 1)
+            {
+                continue;
+            }
+            std::string path = std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist";
+            for(int cpu : parseCpuList(readLine(path)))
+            {
+                if(cpu <= maxCpu)
+                {
+                    nodeOfCpu_[cpu] = node;
+                }
+            }
+        }
+        ::closedir(dir);
+    }
+
+    for(int cpu : cpus_)
+    {
+        char path[96];
+        snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        std::vector<int> siblings = parseCpuList(readLine(path));
+        if(!siblings.empty())
+        {
+            coreOfCpu_[cpu] = *std::min_element(siblings.begin(), siblings.end());
+        }
+        int node = nodeOfCpu_[cpu];
+        if(node >= static_cast<int>(usedNodes.size()))
+        {
+            usedNodes.resize(node + 1, false);
+        }
+        usedNodes[node] = true;
+    }
+    numNodes_ = static_cast<int>(std::count(usedNodes.begin(), usedNodes.end(), true));
+}
+
+int CpuTopology::nodeOf(int cpu) const
+{
+    return cpu >= 0 && cpu < static_cast<int>(nodeOfCpu_.size()) ? nodeOfCpu_[cpu] : 0;
+}
+
+int CpuTopology::nodeOf(const std::vector<int>& cpus) const
+{
+    if(cpus.empty())
+    {
+        return -1;
+    }
+    int node = nodeOf(cpus[0]);
+    for(int cpu : cpus)
+    {
+        if(nodeOf(cpu) != node)
+        {
+            return -1;
+        }
+    }
+    return node;
+}
+
+std::vector<int> CpuTopology::placeLoops(int numLoops) const
+{
+    // 每个节点上的CPU，物理核的第一个超线程排在前面
+    std::vector<int> nodes;
+    std::vector<std::vector<int>> primary;
+    std::vector<std::vector<int>> secondary;
+    std::vector<int> seenCores;
+    for(int cpu : cpus_)
+    {
+        int node = nodeOf(cpu);
+        size_t idx = std::find(nodes.begin(), nodes.end(), node) - nodes.begin();
+        if(idx == nodes.size())
+        {
+            nodes.push_back(node);
+            primary.push_back(std::vector<int>());
+            secondary.push_back(std::vector<int>());
+        }
+        int core = coreOfCpu_[cpu];
+        if(std::find(seenCores.begin(), seenCores.end(), core) == seenCores.end())
+        {
+            seenCores.push_back(core);
+            primary[idx].push_back(cpu);
+        }
+        else
+        {
+            secondary[idx].push_back(cpu);
+        }
+    }
+
+    // 在节点之间交替取，物理核用完以后再用兄弟核
+    std::vector<int> order;
+    for(std::vector<std::vector<int>>* lists : { &primary, &secondary })
+    {
+        size_t longest = 0;
+        for(const std::vector<int>& list : *lists)
+        {
+            longest = std::max(longest, list.size());
+        }
+        for(size_t round = 0; round < longest; ++round)
+        {
+            for(const std::vector<int>& list : *lists)
+            {
+                if(round < list.size())
+                {
+                    order.push_back(list[round]);
+                }
+            }
+        }
+    }
+
+    std::vector<int> placement;
+    for(int i = 0; i < numLoops; ++i)
+    {
+        placement.push_back(order[i % order.size()]);
+    }
+    return placement;
+}
+
+std::vector<int> CpuTopology::parseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    const char* p = list.c_str();
+    while(*p != '\0')
+    {
+        char* end = nullptr;
+        long first = strtol(p, &end, 10);
+        if(end == p)
+        {
+            break;
+        }
+        long last = first;
+        p = end;
+        if(*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for(long cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        if(*p != ',')
+        {
+            break;
+        }
+        ++p;
+    }
+    return cpus;
+}
+
+bool CpuTopology::pinCurrentThread(const std::vector<int>& cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus)
+    {
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    // pid为0作用于调用线程
+    if(::sched_setaffinity(0, sizeof set, &set) < 0)
+    {
+        LOG_ERROR("CpuTopology::pinCurrentThread sched_setaffinity error:%d \n", errno);
+        return false;
+    }
+    return true;
+}
+
+bool CpuTopology::preferNode(int node)
+{
+    const int kBitsPerLong = sizeof(unsigned long) * 8;
+    if(node < 0 || node >= kBitsPerLong)
+    {
+        return false;
+    }
+    unsigned long mask = 1UL << node;
+    // 内核会把maxnode减一，和libnuma一样多传一位
+    if(::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, kBitsPerLong + 1) < 0)
+    {
+        LOG_ERROR("CpuTopology::preferNode set_mempolicy error:%d \n", errno);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <string>
+#include <vector>
+
+/*
+* 进程可以使用的CPU（sched_getaffinity，也就是cpuset限制以后的集合）以及它们的NUMA节点和物理核
+* 拓扑从/sys/devices/system读取，读不到时所有CPU都算在节点0上，每个CPU算一个物理核
+*/
+class CpuTopology : noncopyable
+{
+public:
+    CpuTopology();
+
+    const std::vector<int>& cpus() const { return cpus_; }
+    int numNodes() const { return numNodes_; }
+    int nodeOf(int cpu) const;
+    // cpus都在同一个节点上时返回这个节点，否则返回-1
+    int nodeOf(const std::vector<int>& cpus) const;
+
+    // 给numLoops个loop各分配一个CPU：先用不同的物理核，再用超线程的兄弟核，在NUMA节点之间交替
+    // loop比CPU多时循环使用
+    std::vector<int> placeLoops(int numLoops) const;
+
+    // "0-3,8,10-11"格式的CPU列表
+    static std::vector<int> parseCpuList(const std::string& list);
+
+    // 下面都作用于调用线程，失败返回false
+    // 绑定到cpus上
+    static bool pinCurrentThread(const std::vector<int>& cpus);
+    // 内存优先从node上分配（MPOL_PREFERRED），节点上没有内存时再从其他节点分配
+    static bool preferNode(int node);
+
+private:
+    std::vector<int> cpus_;         // 允许使用的CPU，从小到大
+    std::vector<int> nodeOfCpu_;    // 下标是CPU号
+    std::vector<int> coreOfCpu_;    // 下标是CPU号，同一个物理核的超线程相同（取兄弟核中最小的CPU号）
+    int numNodes_;
+};
@@ -1,5 +1,7 @@
 #include "Poller.h"
 #include "EpollPoller.h"
+#include "UringPoller.h"
+#include "Logger.h"
 
 #include <stdlib.h>
 
@@ -9,8 +11,20 @@ Poller* Poller::newDefaultPoller(EventLoop* loop)
     {
         return nullptr;   // 生成POller实例
     }
+    else if(::getenv("MUDUO_USE_URING"))
+    {
+        UringPoller* poller = new UringPoller(loop);  // 生成io_uring的实例
+        if(poller->valid())
+        {
+            return poller;
+        }
+        // 内核不支持io_uring，退回epoll
+        delete poller;
+        LOG_ERROR("io_uring unavailable, fall back to epoll \n");
+        return new EpollPoller(loop);
+    }
     else
     {
         return new EpollPoller(loop);  // 生成Epoller的实例
     }
-}
\ No newline at end of file
+}
@@ -2,6 +2,10 @@
 #include "Logger.h"
 #include "Poller.h"
 #include "Channel.h"
+#include "TimerQueue.h"
+#include "LoopMetrics.h"
+#include "BufferPool.h"
+#include "TimingWheel.h"
 
 #include <sys/eventfd.h>
 #include <stdlib.h>
@@ -31,11 +35,25 @@ int createEventFd()
 EventLoop::EventLoop()
     : looping_(false)
     , quit_(false)
-    , callingPendingFunctors_(false)
     , threadId_(CurrentThread::tid())
+    , pollPolicy_(kPollBlocking)
+    , spinUs_(0)
+    , busyPollUs_(0)
+    , spinHits_(0)
+    , spinMisses_(0)
     , poller_(Poller::newDefaultPoller(this))
+    , timerQueue_(new TimerQueue(this))
+    , bufferPool_(new BufferPool())
     , wakeupFd_(createEventFd())
     , wakeupChannel_(new Channel(this,wakeupFd_))
+    , nextAfterDispatchDeadlineNs_(0)
+    , callingPendingFunctors_(false)
+    , doneFunctors_(0)
+    , roundMarkerQueued_(false)
+    , wakeupPending_(false)
+    , queuedFunctors_(0)
+    , countFunctors_(false)
+    , freeNodes_(nullptr)
 {
     LOG_DEBUG("EventLoop created %p in thread %d",this,threadId_);
     if(t_loopInThisThread)
@@ -61,6 +79,22 @@ EventLoop::~EventLoop()
     wakeupChannel_->remove();
     ::close(wakeupFd_);
     t_loopInThisThread = nullptr;
+
+    // 释放没有来得及执行的回调
+    while(PendingFunctor* node = pendingFunctors_.pop())
+    {
+        if(node != &roundMarker_)
+        {
+            delete node;
+        }
+    }
+    PendingFunctor* node = freeNodes_.exchange(nullptr);
+    while(node != nullptr)
+    {
+        PendingFunctor* next = node->next_.load(std::memory_order_relaxed);
+        delete node;
+        node = next;
+    }
 }
 
 void EventLoop::handleRead()
@@ -89,27 +123,197 @@ void EventLoop::loop()
             clientfd -- 与客户端通信的channel
             wakeupfd  -- mainloop唤醒subloop的channel
         */
-        pollReturnTime_ = poller_->poll(kPollTimeMs,&activeChannels_);
+        int timeoutMs = pollTimeoutMs();
+        int64_t pollStartNs = metrics_ ? LoopMetrics::nowNs() : 0;
+        pollReturnTime_ = poller_->poll(timeoutMs,&activeChannels_);
+        int64_t dispatchStartNs = 0;
+        if(metrics_)
+        {
+            dispatchStartNs = LoopMetrics::nowNs();
+            metrics_->beginDispatch(dispatchStartNs);
+        }
+        if(!activeChannels_.empty())
+        {
+            lastActiveTime_ = pollReturnTime_;
+        }
+        else if(timeoutMs != 0)
+        {
+            // 阻塞poll超时返回，loop空闲，把缓存的Buffer存储还给系统
+            bufferPool_->trim(BufferPool::kIdleCachedBytes);
+        }
+        if(timeoutMs == 0)
+        {
+            // 只有loop线程会写，不需要原子的读-改-写
+            std::atomic<uint64_t>& counter = activeChannels_.empty() ? spinMisses_ : spinHits_;
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
         
         // 遍历活跃的channel
         for(Channel* channel : activeChannels_)
         {
+            // 有合并写的连接等不到本轮结束了，先把它们发送出去
+            if(nextAfterDispatchDeadlineNs_ != 0)
+            {
+                int64_t nowNs = LoopMetrics::nowNs();
+                if(nowNs >= nextAfterDispatchDeadlineNs_)
+                {
+                    runAfterDispatch(nowNs);
+                }
+            }
             // poller监听那些channel发生事件了，上报给EventLoop，通知相应的channel处理相应的事件
             channel->handleEvent(pollReturnTime_);
         }
+        if(!afterDispatch_.empty())
+        {
+            runAfterDispatch(0);
+        }
         // 执行当前Eventloop事件循环需要处理的回调操作
         /*
         * IO线程（mainReactor，主要做接收新用户的连接accept，我们肯定使用一个channel打包返回的fd，已连接的channel要分发给subReactor，服务器肯定是用多线程的）
         * mainLoop事先注册一个callback，这个cb需要subloop执行，但是现在subloop还在睡眠，所以需要mainloop把subloop给wakeup
         *  subloop起来之后在这个函数做的事情就是doPendingFunctors  --  执行之前mainLoop给注册的回调，回调都在pendingFunctors_里写的
         */
-        doPendingFunctors();
+        int64_t functorsStartNs = metrics_ ? LoopMetrics::nowNs() : 0;
+        size_t numFunctors = doPendingFunctors();
+        if(!afterDispatch_.empty())
+        {
+            // 回调中（比如其他线程的send）产生的合并写
+            runAfterDispatch(0);
+        }
+
+        if(metrics_)
+        {
+            int64_t endNs = LoopMetrics::nowNs();
+            metrics_->recordIteration(dispatchStartNs - pollStartNs,
+                                      functorsStartNs - dispatchStartNs,
+                                      endNs - functorsStartNs,
+                                      activeChannels_.size(),
+                                      numFunctors);
+        }
     }
 
     LOG_INFO("EventLoop %p stop looping!\n",this);
     looping_ = false;
 }
 
+EventLoop::PendingFunctor* EventLoop::allocNode()
+{
+    // 每个线程缓存一批空闲节点，线程退出的时候释放
+    struct NodeCache
+    {
+        PendingFunctor* head = nullptr;
+        ~NodeCache()
+        {
+            while(head != nullptr)
+            {
+                PendingFunctor* next = head->next_.load(std::memory_order_relaxed);
+                delete head;
+                head = next;
+            }
+        }
+    };
+    static thread_local NodeCache cache;
+
+    if(cache.head == nullptr)
+    {
+        // 用exchange一次取走整个链表，不存在多个线程逐个弹出时的ABA问题
+        cache.head = freeNodes_.exchange(nullptr, std::memory_order_acquire);
+    }
+    if(cache.head != nullptr)
+    {
+        PendingFunctor* node = cache.head;
+        cache.head = node->next_.load(std::memory_order_relaxed);
+        return node;
+    }
+    return new PendingFunctor;
+}
+
+void EventLoop::freeNode(PendingFunctor* node)
+{
+    node->functor = nullptr;    // 在loop线程里释放回调捕获的对象
+    PendingFunctor* head = freeNodes_.load(std::memory_order_relaxed);
+    do
+    {
+        node->next_.store(head, std::memory_order_relaxed);
+    } while(!freeNodes_.compare_exchange_weak(head, node,
+                std::memory_order_release, std::memory_order_relaxed));
+}
+
+void EventLoop::enableMetrics()
+{
+    if(!metrics_)
+    {
+        metrics_.reset(new LoopMetrics);
+    }
+}
+
+TimingWheel* EventLoop::timingWheel()
+{
+    if(!timingWheel_)
+    {
+        timingWheel_.reset(new TimingWheel(this));
+    }
+    return timingWheel_.get();
+}
+
+int EventLoop::pollTimeoutMs() const
+{
+    switch(pollPolicy_)
+    {
+    case kPollSpin:
+        return 0;
+    case kPollSpinThenBlock:
+        // 距离上一次有事件还在spinUs_之内，继续轮询，否则认为loop空闲了，阻塞等待
+        if(lastActiveTime_.valid()
+            && TimeStamp::now().microSecondsSinceEpoch() - lastActiveTime_.microSecondsSinceEpoch() < spinUs_)
+        {
+            return 0;
+        }
+        return kPollTimeMs;
+    default:
+        return kPollTimeMs;
+    }
+}
+
+// 登记本轮dispatch结束时执行的回调，deadlineUs > 0时记下最晚执行的时间
+void EventLoop::queueAfterDispatch(Functor cb, int deadlineUs)
+{
+    AfterDispatch entry;
+    entry.deadlineNs = deadlineUs > 0 ? LoopMetrics::nowNs() + static_cast<int64_t>(deadlineUs) * 1000 : 0;
+    entry.cb = std::move(cb);
+    if(entry.deadlineNs != 0
+        && (nextAfterDispatchDeadlineNs_ == 0 || entry.deadlineNs < nextAfterDispatchDeadlineNs_))
+    {
+        nextAfterDispatchDeadlineNs_ = entry.deadlineNs;
+    }
+    afterDispatch_.push_back(std::move(entry));
+}
+
+void EventLoop::runAfterDispatch(int64_t nowNs)
+{
+    // 回调中可能再调用queueAfterDispatch，先交换出来再执行
+    runningAfterDispatch_.swap(afterDispatch_);
+    nextAfterDispatchDeadlineNs_ = 0;
+    for(AfterDispatch& entry : runningAfterDispatch_)
+    {
+        if(nowNs == 0 || (entry.deadlineNs != 0 && entry.deadlineNs <= nowNs))
+        {
+            entry.cb();
+        }
+        else
+        {
+            // 还没到deadline的放回去，等本轮结束
+            if(entry.deadlineNs != 0
+                && (nextAfterDispatchDeadlineNs_ == 0 || entry.deadlineNs < nextAfterDispatchDeadlineNs_))
+            {
+                nextAfterDispatchDeadlineNs_ = entry.deadlineNs;
+            }
+            afterDispatch_.push_back(std::move(entry));
+        }
+    }
+    runningAfterDispatch_.clear();
+}
+
 // 退出事件循环
 void EventLoop::quit()
 {
@@ -136,22 +340,32 @@ void EventLoop::runInLoop(Functor cb)
     }
     else
     {// 在非当前loop线程中执行cb，就需要唤醒loop所在线程执行cb
-        queueInLoop(cb);
+        queueInLoop(std::move(cb));
     }
 }
 // 把cb放入队列中，唤醒loop所在的线程，执行cb
 void EventLoop::queueInLoop(Functor cb)
 {
+    PendingFunctor* node = allocNode();
+    node->functor = std::move(cb);
+    // push以后node随时可能被loop执行完回收，不能再读node
+    const bool counted = countFunctors_.load(std::memory_order_relaxed);
+    node->counted = counted;
+    pendingFunctors_.push(node);
+    if(counted)
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        pendingFunctors_.emplace_back(cb);
+        queuedFunctors_.fetch_add(1, std::memory_order_relaxed);
     }
 
     // 唤醒相应的需要执行上面回调操作的loop的线程
     // || callingPendingFunctors_：当前loop正在执行回调，又给当前loop添加
+    // 已经有一次唤醒还没有被处理的时候，不需要再写eventfd，这个回调会在同一轮doPendingFunctors中执行
     if(!isInLoopThread() || callingPendingFunctors_)
     {
-        wakeup();  // 唤醒loop所在的线程
+        if(!wakeupPending_.exchange(true))
+        {
+            wakeup();  // 唤醒loop所在的线程
+        }
     }
 }
 
@@ -171,6 +385,28 @@ void EventLoop::wakeup()
     }
 }
 
+TimerId EventLoop::runAt(TimeStamp time, TimerCallback cb)
+{
+    return timerQueue_->addTimer(std::move(cb), time, 0.0);
+}
+
+TimerId EventLoop::runAfter(double delay, TimerCallback cb)
+{
+    TimeStamp time(addTime(TimeStamp::now(), delay));
+    return runAt(time, std::move(cb));
+}
+
+TimerId EventLoop::runEvery(double interval, TimerCallback cb)
+{
+    TimeStamp time(addTime(TimeStamp::now(), interval));
+    return timerQueue_->addTimer(std::move(cb), time, interval);
+}
+
+void EventLoop::cancel(TimerId timerId)
+{
+    timerQueue_->cancel(timerId);
+}
+
 // EventLoop的方法 - 》 poller的方法
 void EventLoop::updateChannel(Channel* channel)
 {
@@ -186,20 +422,51 @@ bool EventLoop::hasChannel(Channel* channel)
     return poller_->hasChannel(channel);
 }
 
-void EventLoop::doPendingFunctors()
+size_t EventLoop::doPendingFunctors()
 {
-    std::vector<Functor> functors;
+    size_t numFunctors = 0;
+    uint64_t numCounted = 0;
     callingPendingFunctors_ = true;
 
+    // 先清除唤醒标志再取回调，之后入队的回调会重新唤醒一次loop
+    wakeupPending_.exchange(false);
+
+    // 只执行到当前队尾为止，回调里再入队的回调放到下一轮执行，和之前swap的语义一样
+    // 队尾用roundMarker_标记：先把它入队，取到它就结束这一轮
+    // pop遇到正在push的生产者会提前返回nullptr，这时roundMarker_留在队列中，那个生产者push完会再唤醒loop，下一轮接着取到它为止
+    if(!roundMarkerQueued_ && !pendingFunctors_.empty())
     {
-        std::unique_lock<std::mutex> locker(mutex_);
-        functors.swap(pendingFunctors_);
+        pendingFunctors_.push(&roundMarker_);
+        roundMarkerQueued_ = true;
     }
-
-    for(const Functor& functor : functors)
+    if(roundMarkerQueued_)
     {
-        functor();   // 执行当前loop需要执行的回调操作
+        while(PendingFunctor* node = pendingFunctors_.pop())
+        {
+            if(node == &roundMarker_)
+            {
+                roundMarkerQueued_ = false;
+                break;
+            }
+            node->functor();   // 执行当前loop需要执行的回调操作
+            ++numFunctors;
+            numCounted += node->counted;
+            freeNode(node);
+        }
     }
 
+    if(numCounted > 0)
+    {
+        doneFunctors_.store(doneFunctors_.load(std::memory_order_relaxed) + numCounted, std::memory_order_relaxed);
+    }
     callingPendingFunctors_ = false;
+    return numFunctors;
+}
+
+size_t EventLoop::pendingFunctors() const
+{
+    // 入队以后才计数，回调可能在计数之前就被执行了，所以执行数可能暂时超过入队数
+    uint64_t done = doneFunctors_.load(std::memory_order_relaxed);
+    uint64_t queued = queuedFunctors_.load(std::memory_order_relaxed);
+    return queued > done ? static_cast<size_t>(queued - done) : 0;
 }
\ No newline at end of file
@@ -6,13 +6,21 @@
 #include <vector>
 #include <atomic>
 #include <memory>
-#include <mutex>
 
 #include "TimeStamp.h"
 #include "CurrentThread.h"
+#include "Callbacks.h"
+#include "TimerId.h"
+#include "MpscQueue.h"
+#include "SmallFunction.h"
+#include "LoopLoad.h"
 
 class Channel;
 class Poller;
+class TimerQueue;
+class LoopMetrics;
+class BufferPool;
+class TimingWheel;
 /*
 * 事件循环类  
 * 主要包含两大模块：Channel(连接通道)  Poller(Epoll、poll的抽象)
@@ -20,7 +28,17 @@ class Poller;
 class EventLoop : noncopyable
 {
 public:
-    using Functor = std::function<void()>;
+    // 只能移动，捕获的状态放在对象内部的缓冲区里，跨线程投递回调不需要分配内存
+    using Functor = SmallFunction<void()>;
+
+    // poll的等待策略
+    enum PollPolicy
+    {
+        kPollBlocking,      // 一直阻塞在poll中，直到有事件或者超时
+        kPollSpinThenBlock, // 最近一次有事件之后的spinUs微秒内用0超时轮询，之后再阻塞
+        kPollSpin,          // 一直用0超时轮询，适合独占核心的低延迟loop
+    };
+
     EventLoop();
     ~EventLoop();
 
@@ -31,14 +49,60 @@ public:
 
     TimeStamp pollReturnTime() const {return pollReturnTime_;}
 
+    // 设置poll的等待策略，需要在loop开始之前或者在loop所在的线程中调用（比如ThreadInitCallback）
+    void setPollPolicy(PollPolicy policy, int spinUs = 50) { pollPolicy_ = policy; spinUs_ = spinUs; }
+    PollPolicy pollPolicy() const { return pollPolicy_; }
+
+    // 给这个loop上的连接设置SO_BUSY_POLL（微秒），0表示不设置，在连接建立时生效
+    void setBusyPollUs(int us) { busyPollUs_ = us; }
+    int busyPollUs() const { return busyPollUs_; }
+
+    // 打开每轮循环的统计，需要在loop开始之前或者在loop所在的线程中调用
+    void enableMetrics();
+    // 没有打开统计时返回nullptr，返回的对象可以在任意线程读取
+    const LoopMetrics* metrics() const { return metrics_.get(); }
+
+    // 这个loop上的连接的Buffer从这里分配存储，统计数据可以在任意线程读取
+    BufferPool* bufferPool() const { return bufferPool_.get(); }
+
+    // 空闲超时用的1秒粒度的时间轮，第一次调用时创建，只能在loop线程调用
+    TimingWheel* timingWheel();
+
+    // 这个loop上的活跃连接数和收发字节数，由TcpConnection在loop线程中更新，可以在任意线程读取
+    LoopLoad& load() { return load_; }
+    const LoopLoad& load() const { return load_; }
+
+    // 0超时的poll拿到事件/没有拿到事件的次数，可以在任意线程读取
+    uint64_t spinHits() const { return spinHits_.load(std::memory_order_relaxed); }
+    uint64_t spinMisses() const { return spinMisses_.load(std::memory_order_relaxed); }
+
+    // 已经入队还没有执行的回调数（近似值），可以在任意线程读取，用来判断loop是否积压
+    // 统计要在每次投递时多一次原子加，默认不统计（返回0），需要的时候（TcpServer设置了队列深度的阈值）再打开
+    void setCountPendingFunctors(bool on) { countFunctors_.store(on, std::memory_order_relaxed); }
+    size_t pendingFunctors() const;
+
     // 在当前loop中执行
     void runInLoop(Functor cb);
     // 把cb放入队列中，唤醒loop所在的线程，执行cb
     void queueInLoop(Functor cb);
 
+    // 本轮处理完channel事件以后（以及执行完pendingFunctors以后）执行cb，只能在loop线程调用，用于合并写（auto-cork）
+    // deadlineUs > 0时，如果处理事件的过程已经超过了deadlineUs，会在处理下一个channel之前提前执行
+    void queueAfterDispatch(Functor cb, int deadlineUs = 0);
+
     // mainReactor唤醒subReactor，也就是唤醒loop所在的线程
     void wakeup();
 
+    // 定时器 都是线程安全的，回调在loop所在的线程中执行
+    // 在time时刻执行cb
+    TimerId runAt(TimeStamp time, TimerCallback cb);
+    // 延迟delay秒后执行cb
+    TimerId runAfter(double delay, TimerCallback cb);
+    // 每隔interval秒执行一次cb
+    TimerId runEvery(double interval, TimerCallback cb);
+    // 取消定时器
+    void cancel(TimerId timerId);
+
     // EventLoop的方法 - 》 poller的方法
     void updateChannel(Channel* channel);
     void removeChannel(Channel* channel);
@@ -52,15 +116,51 @@ private:
     // wakeup
     void handleRead();
 
-    // 主要是打印下活跃的channel
-    void doPendingFunctors();
+    // 主要是打印下活跃的channel，返回执行的回调个数
+    size_t doPendingFunctors();
+
+    // 根据pollPolicy_计算本轮poll的超时时间
+    int pollTimeoutMs() const;
+
+    // 执行queueAfterDispatch的回调，nowNs为0时全部执行，否则只执行deadline已经到了的
+    void runAfterDispatch(int64_t nowNs);
 
-    std::atomic_bool looping_;           // 原子操作 通过CAS实现
-    std::atomic_bool quit_; // 标识推出loop循环
+    struct AfterDispatch
+    {
+        int64_t deadlineNs;     // 0表示没有deadline
+        Functor cb;
+    };
+
+    // 待执行的回调，节点里直接存放Functor，入队不需要加锁
+    struct PendingFunctor
+    {
+        std::atomic<PendingFunctor*> next_;
+        Functor functor;
+        bool counted;   // 入队时计入了queuedFunctors_，执行时也要计入doneFunctors_
+    };
+
+    // 回调节点的分配和回收，节点在loop和投递线程之间循环使用，稳定以后不再分配内存
+    PendingFunctor* allocNode();    // 任意线程
+    void freeNode(PendingFunctor* node);    // 只在loop线程
+
+    // 这几个标志会被其他线程频繁读写，分别放在独立的缓存行上
+    alignas(kCacheLineSize) std::atomic_bool looping_;           // 原子操作 通过CAS实现
+    alignas(kCacheLineSize) std::atomic_bool quit_; // 标识推出loop循环
     
     const pid_t threadId_;      //记录当前loop所在的线程的ID ，每一个eventloop都是一个线程
     TimeStamp pollReturnTime_;  //poller返回事件发生channels的时间
+    TimeStamp lastActiveTime_;  //最近一次poll返回了事件的时间，kPollSpinThenBlock用来判断是否还在轮询窗口内
+
+    PollPolicy pollPolicy_;
+    int spinUs_;
+    int busyPollUs_;
+    std::atomic<uint64_t> spinHits_;    // 只有loop线程写
+    std::atomic<uint64_t> spinMisses_;
     std::unique_ptr<Poller> poller_;
+    std::unique_ptr<TimerQueue> timerQueue_;    // 定时器队列，依赖poller_，所以要在poller_之后构造
+    std::unique_ptr<LoopMetrics> metrics_;      // 每轮循环的统计，默认关闭
+    std::unique_ptr<BufferPool> bufferPool_;    // Buffer存储池，只在loop线程缓存
+    std::unique_ptr<TimingWheel> timingWheel_;  // 依赖timerQueue_，要在timerQueue_之前析构
 
     int wakeupFd_;      // 当mainLoop获取一个新用户的channel。通过轮询算法选择一个subloop，通过该成员唤醒subloop处理channel(每个subReactor都监听wakefd)。通过系统调用eventfd，线程间的通信机制，效率比较高
 
@@ -68,7 +168,22 @@ private:
 
     ChannelList activeChannels_;  //eventLoop管理的所有的channel
 
-    std::atomic_bool callingPendingFunctors_;   // 标识当前loop是否需要执行的回调操作
-    std::vector<Functor> pendingFunctors_;   // 存储Loop需要执行的所有的回调操作
-    std::mutex mutex_;      // 回调操作，用来保护上面vector容器的线程安全的
+    std::vector<AfterDispatch> afterDispatch_;   // 本轮dispatch结束时执行的回调
+    std::vector<AfterDispatch> runningAfterDispatch_;   // 正在执行的回调，和afterDispatch_交换着用，避免每轮重新分配
+    int64_t nextAfterDispatchDeadlineNs_;       // afterDispatch_中最早的deadline，0表示没有
+
+    // 其他线程（选择loop的baseLoop）会读，和loop线程频繁写的成员分开
+    alignas(kCacheLineSize) LoopLoad load_;
+
+    alignas(kCacheLineSize) std::atomic_bool callingPendingFunctors_;   // 标识当前loop是否需要执行的回调操作
+    std::atomic<uint64_t> doneFunctors_;    // 执行过的回调数，只有loop线程写
+    bool roundMarkerQueued_;                // roundMarker_是否在队列中，只有loop线程访问
+    // 是否已经向wakeupFd_写过数据还没有被处理，连续多次queueInLoop只写一次eventfd
+    alignas(kCacheLineSize) std::atomic_bool wakeupPending_;
+    std::atomic<uint64_t> queuedFunctors_;  // 入队过的回调数，投递线程本来就要写wakeupPending_，放在同一个缓存行上
+    std::atomic_bool countFunctors_;        // 是否统计queuedFunctors_/doneFunctors_
+    MpscQueue<PendingFunctor> pendingFunctors_;   // 存储Loop需要执行的所有的回调操作，多个线程无锁入队
+    PendingFunctor roundMarker_;    // doPendingFunctors每一轮的结束标记，由loop线程入队
+    // loop执行完回调以后回收的节点，投递线程一次把整个链表取走放到自己的线程缓存中
+    alignas(kCacheLineSize) std::atomic<PendingFunctor*> freeNodes_;
 };
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "EventLoopThread.h"
 #include "EventLoop.h"
+#include "CpuTopology.h"
 
 #include <memory>
 
@@ -9,7 +10,8 @@ EventLoopThread::EventLoopThread(const ThreadInitCallback& cb , const std::strin
       thread_(std::bind(&EventLoopThread::threadFunc, this), name),
       mutex_(),
       cond_(),
-      callback_(cb)
+      callback_(cb),
+      node_(-1)
 {
 }
 
@@ -46,6 +48,15 @@ EventLoop* EventLoopThread::startLoop()
 // 在单独的新线程里面运行的
 void EventLoopThread::threadFunc()
 {
+    // 先绑定CPU和内存节点再创建EventLoop，按首次访问分配的内存也落在本地节点上
+    if(!cpus_.empty())
+    {
+        CpuTopology::pinCurrentThread(cpus_);
+    }
+    if(node_ >= 0)
+    {
+        CpuTopology::preferNode(node_);
+    }
     EventLoop loop;  // 创建一个独立的EventLoop，和上面的线程是一一对应的，one loop per thread
     if(callback_)
     {
@@ -8,6 +8,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <string>
+#include <vector>
 
 class EventLoop;
 
@@ -20,6 +21,10 @@ public:
 
     EventLoop* startLoop();
 
+    // 线程绑定到cpus上，node >= 0时内存优先从这个NUMA节点分配，需要在startLoop之前设置
+    // 都在创建EventLoop之前生效，loop的poller、定时器队列、Buffer池等都在绑定以后的线程中分配
+    void setCpuAffinity(const std::vector<int>& cpus, int node = -1) { cpus_ = cpus; node_ = node; }
+
 private:
 
     void threadFunc();
@@ -30,4 +35,6 @@ private:
     std::mutex mutex_;
     std::condition_variable cond_;
     ThreadInitCallback callback_;
+    std::vector<int> cpus_;     // 空表示不绑定
+    int node_;
 };
\ No newline at end of file
@@ -1,6 +1,27 @@
 #include "EventLoopThreadPool.h"
 #include "EventLoopThread.h"
 #include "EventLoop.h"
+#include "LoopMetrics.h"
+#include "InetAddress.h"
+#include "CpuTopology.h"
+#include "Logger.h"
+
+#include <algorithm>
+
+// 吞吐和利用率的采样间隔，间隔太短速率抖动大，太长反应慢
+static const int64_t kSampleIntervalNs = 100 * 1000 * 1000;
+// 一致性哈希每个loop的虚拟节点数，越多分布越均匀
+static const int kVirtualNodes = 100;
+
+// splitmix64的混合函数，取高32位作为哈希值
+static uint32_t mix32(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return static_cast<uint32_t>(x >> 32);
+}
 
 EventLoopThreadPool::EventLoopThreadPool(EventLoop* baseLoop, const std::string& nameArg)
     : baseLoop_(baseLoop)
@@ -8,6 +29,10 @@ EventLoopThreadPool::EventLoopThreadPool(EventLoop* baseLoop, const std::string&
     , started_(false)
     , numThreads_(0)
     , next_(0)
+    , strategy_(kRoundRobin)
+    , metric_(kLoadConnections)
+    , randomState_(reinterpret_cast<uintptr_t>(this) | 1)
+    , autoAffinity_(false)
 {
 
 }
@@ -19,12 +44,35 @@ EventLoopThreadPool:: ~EventLoopThreadPool()
 void  EventLoopThreadPool::start(const ThreadInitCallback& cb)
 {
     started_ = true;
+    CpuTopology topology;
+    std::vector<int> placement;
+    if(autoAffinity_)
+    {
+        placement = topology.placeLoops(numThreads_);
+    }
     for (int i = 0; i < numThreads_; ++i)
     {
         char buf[name_.size() + 32];
         // 线程池名字+下标
         snprintf(buf, sizeof(buf), "%s%d", name_.c_str(), i);
         EventLoopThread* t = new EventLoopThread(cb, buf);
+        std::vector<int> cpus;
+        if(i < static_cast<int>(cpuLists_.size()) && !cpuLists_[i].empty())
+        {
+            cpus = cpuLists_[i];
+        }
+        else if(!placement.empty())
+        {
+            cpus.push_back(placement[i]);
+        }
+        if(!cpus.empty())
+        {
+            // 只有一个节点时不需要设置内存策略
+            int node = topology.numNodes() > 1 ? topology.nodeOf(cpus) : -1;
+            t->setCpuAffinity(cpus, node);
+            LOG_INFO("EventLoopThreadPool %s loop %d on cpu %d%s node %d \n",
+                name_.c_str(), i, cpus[0], cpus.size() > 1 ? "..." : "", topology.nodeOf(cpus));
+        }
         threads_.emplace_back(std::unique_ptr<EventLoopThread>(t));
         loops_.push_back(threads_[i]->startLoop()); // 底层创建线程，绑定一个新的EventLoop，返回该loop地址
     }
@@ -34,6 +82,22 @@ void  EventLoopThreadPool::start(const ThreadInitCallback& cb)
     {
         cb(baseLoop_);
     }
+
+    int64_t now = LoopMetrics::nowNs();
+    for(EventLoop* loop : loops_)
+    {
+        LoadSample sample = { now, loop->load().bytes(), 0, 0, 0.0, 0.0 };
+        if(loop->metrics())
+        {
+            sample.busyNs = loop->metrics()->busyNs();
+            sample.totalNs = loop->metrics()->totalNs();
+        }
+        samples_.push_back(sample);
+    }
+    if(strategy_ == kConsistentHash)
+    {
+        buildHashRing();
+    }
 }
 
 //如果工作在多线程中，baseLoop_会默认以轮询的方式分配channel给subloop
@@ -51,6 +115,142 @@ EventLoop* EventLoopThreadPool::getNextLoop()
     }
     return loop;
 }
+
+EventLoop* EventLoopThreadPool::getNextLoop(const InetAddress& peerAddr)
+{
+    if(loops_.size() <= 1)
+    {
+        return getNextLoop();
+    }
+    switch(strategy_)
+    {
+    case kLeastConnections:
+        return leastConnections();
+    case kPowerOfTwoChoices:
+        return powerOfTwoChoices();
+    case kConsistentHash:
+    {
+        // 只用IP不用端口，同一个客户端的多个连接落在同一个loop上
+        uint32_t h = mix32(peerAddr.getSockAddr()->sin_addr.s_addr);
+        std::vector<std::pair<uint32_t, int>>::const_iterator it =
+            std::lower_bound(hashRing_.begin(), hashRing_.end(), std::make_pair(h, 0));
+        if(it == hashRing_.end())
+        {
+            it = hashRing_.begin();  // 环绕到第一个节点
+        }
+        return loops_[it->second];
+    }
+    default:
+        return getNextLoop();
+    }
+}
+
+// 连接数相同时从轮询下标开始找，避免总是落在第一个loop上
+EventLoop* EventLoopThreadPool::leastConnections()
+{
+    const int n = static_cast<int>(loops_.size());
+    int best = next_;
+    int64_t bestConns = loops_[best]->load().connections();
+    for(int i = 1; i < n && bestConns > 0; ++i)
+    {
+        int idx = (next_ + i) % n;
+        int64_t conns = loops_[idx]->load().connections();
+        if(conns < bestConns)
+        {
+            best = idx;
+            bestConns = conns;
+        }
+    }
+    next_ = (next_ + 1) % n;
+    return loops_[best];
+}
+
+// 随机选两个不同的loop取负载低的，比扫描所有loop便宜，也不会让同一时刻的新连接都涌向同一个最空闲的loop
+EventLoop* EventLoopThreadPool::powerOfTwoChoices()
+{
+    const uint32_t n = static_cast<uint32_t>(loops_.size());
+    randomState_ ^= randomState_ << 13;
+    randomState_ ^= randomState_ >> 7;
+    randomState_ ^= randomState_ << 17;
+    int a = static_cast<int>(randomState_ % n);
+    int b = static_cast<int>((a + 1 + (randomState_ >> 32) % (n - 1)) % n);
+
+    double loadA = loadOf(a);
+    double loadB = loadOf(b);
+    if(loadA == loadB)
+    {
+        return loops_[a]->load().connections() <= loops_[b]->load().connections() ? loops_[a] : loops_[b];
+    }
+    return loadA < loadB ? loops_[a] : loops_[b];
+}
+
+double EventLoopThreadPool::loadOf(int idx)
+{
+    EventLoop* loop = loops_[idx];
+    switch(metric_)
+    {
+    case kLoadThroughput:
+        refreshSample(idx);
+        return samples_[idx].bytesPerSec;
+    case kLoadUtilization:
+        if(loop->metrics())
+        {
+            refreshSample(idx);
+            return samples_[idx].utilization;
+        }
+        return static_cast<double>(loop->load().connections());
+    default:
+        return static_cast<double>(loop->load().connections());
+    }
+}
+
+void EventLoopThreadPool::refreshSample(int idx)
+{
+    LoadSample& sample = samples_[idx];
+    int64_t now = LoopMetrics::nowNs();
+    if(now - sample.atNs < kSampleIntervalNs)
+    {
+        return;
+    }
+
+    EventLoop* loop = loops_[idx];
+    uint64_t bytes = loop->load().bytes();
+    sample.bytesPerSec = static_cast<double>(bytes - sample.bytes) * 1e9 / (now - sample.atNs);
+    sample.bytes = bytes;
+    if(loop->metrics())
+    {
+        uint64_t busyNs = loop->metrics()->busyNs();
+        uint64_t totalNs = loop->metrics()->totalNs();
+        if(totalNs > sample.totalNs)
+        {
+            sample.utilization = static_cast<double>(busyNs - sample.busyNs) / (totalNs - sample.totalNs);
+        }
+        else
+        {
+            // 这段时间内一轮都没有结束：要么一直阻塞在poll中（空闲），要么卡在一个很慢的handler中
+            int64_t busyFor = loop->metrics()->busyForNs();
+            sample.utilization = std::min(1.0, static_cast<double>(busyFor) / (now - sample.atNs));
+        }
+        sample.busyNs = busyNs;
+        sample.totalNs = totalNs;
+    }
+    sample.atNs = now;
+}
+
+void EventLoopThreadPool::buildHashRing()
+{
+    hashRing_.clear();
+    for(int i = 0; i < static_cast<int>(loops_.size()); ++i)
+    {
+        for(int v = 0; v < kVirtualNodes; ++v)
+        {
+            uint64_t key = (static_cast<uint64_t>(i) << 32) | static_cast<uint32_t>(v);
+            hashRing_.push_back(std::make_pair(mix32(key ^ 0x5bd1e995ULL), i));
+        }
+    }
+    std::sort(hashRing_.begin(), hashRing_.end());
+}
+
 std::vector<EventLoop*> EventLoopThreadPool::getAllLoops()
 {
     if(loops_.empty())
@@ -6,21 +6,51 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <utility>
+#include <stdint.h>
 
 class EventLoop;
 class EventLoopThread;
+class InetAddress;
 
 class EventLoopThreadPool : noncopyable
 {
     using ThreadInitCallback = std::function<void(EventLoop*)>;
 public:
+    // 选择subloop的策略
+    enum Strategy
+    {
+        kRoundRobin,            // 轮询
+        kLeastConnections,      // 活跃连接最少的loop，每次要扫描所有loop
+        kPowerOfTwoChoices,     // 随机选两个loop，取负载低的那个，负载用LoadMetric衡量
+        kConsistentHash,        // 按对端IP一致性哈希，同一个客户端的连接落在同一个loop上，loop数不变时映射不变
+    };
+
+    // kPowerOfTwoChoices比较的负载
+    enum LoadMetric
+    {
+        kLoadConnections,       // 活跃连接数
+        kLoadThroughput,        // 最近的收发字节速率
+        kLoadUtilization,       // 最近的loop利用率，需要loop打开了统计（EventLoop::enableMetrics），否则按连接数比较
+    };
+
     EventLoopThreadPool(EventLoop* baseLoop, const std::string& nameArg);
     ~EventLoopThreadPool();
     void setThreadNum(int numThreads) { numThreads_ = numThreads; }  // 设置线程数量
+    // 设置选择subloop的策略，需要在start之前调用
+    void setStrategy(Strategy strategy, LoadMetric metric = kLoadConnections) { strategy_ = strategy; metric_ = metric; }
+    Strategy strategy() const { return strategy_; }
+    // 第i个loop的线程绑定到cpuLists[i]中的CPU上，没有对应项或者为空的loop不绑定，需要在start之前设置
+    void setCpuAffinity(const std::vector<std::vector<int>>& cpuLists) { cpuLists_ = cpuLists; }
+    // 按进程允许使用的CPU（cpuset）和NUMA拓扑自动给每个loop分配一个CPU，见CpuTopology::placeLoops
+    // 和setCpuAffinity一起使用时，setCpuAffinity指定了的loop以它为准
+    void setAutoAffinity(bool on) { autoAffinity_ = on; }
     void start(const ThreadInitCallback& cb = ThreadInitCallback());  // 启动线程池
 
     //如果工作在多线程中，baseLoop_会默认以轮询的方式分配channel给subloop
-    EventLoop* getNextLoop();  // 获取下一个EventLoop对象
+    // 下面两个都只能在baseLoop_所在的线程中调用
+    EventLoop* getNextLoop();  // 获取下一个EventLoop对象，kConsistentHash时退化为轮询
+    EventLoop* getNextLoop(const InetAddress& peerAddr);  // 按strategy_给对端为peerAddr的新连接选择loop
     std::vector<EventLoop*> getAllLoops();  // 获取所有的EventLoop对象
     bool started() const { return started_; }  // 是否已经开始
     const std::string& name() const { return name_; }  // 获取线程池的名字
@@ -33,4 +63,29 @@ private:
     int next_;  // 下一个线程的索引,轮询下标
     std::vector<std::unique_ptr<EventLoopThread>> threads_;  // 线程池
     std::vector<EventLoop*> loops_;  // 线程池里面的EventLoop对象，不需要delete，因为是栈上管理的，在EventLoopThrad中创建的
+
+    // 每个loop最近一次的负载采样，kLoadThroughput/kLoadUtilization按采样间隔计算速率
+    struct LoadSample
+    {
+        int64_t atNs;
+        uint64_t bytes;
+        uint64_t busyNs;
+        uint64_t totalNs;
+        double bytesPerSec;
+        double utilization;
+    };
+
+    EventLoop* leastConnections();
+    EventLoop* powerOfTwoChoices();
+    double loadOf(int idx);         // 按metric_计算第idx个loop的负载
+    void refreshSample(int idx);    // 采样过期了就重新采样
+    void buildHashRing();
+
+    Strategy strategy_;
+    LoadMetric metric_;
+    uint64_t randomState_;          // xorshift随机数的状态
+    std::vector<LoadSample> samples_;
+    std::vector<std::pair<uint32_t, int>> hashRing_;  // (哈希值, loop下标)，按哈希值排序
+    std::vector<std::vector<int>> cpuLists_;    // 每个loop绑定的CPU
+    bool autoAffinity_;
 };
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "LengthHeaderCodec.h"
+#include "Buffer.h"
+#include "TcpConnection.h"
+#include "Logger.h"
+
+#include <algorithm>
+
+const size_t LengthHeaderCodec::kHeaderLen;
+const size_t LengthHeaderCodec::kDefaultMaxFrameLength;
+
+LengthHeaderCodec::LengthHeaderCodec(const FrameCallback& cb, size_t maxFrameLength)
+    : frameCallback_(cb)
+    , maxFrameLength_(maxFrameLength)
+{
+}
+
+void LengthHeaderCodec::onMessage(const TcpConnectionPtr& conn, Buffer* buf, TimeStamp receiveTime)
+{
+    if(!conn->connected())
+    {
+        // 已经因为非法长度关闭了（或者正在关闭），后面的数据不再解析
+        buf->retrieveAll();
+        return;
+    }
+
+    while(buf->readableBytes() >= kHeaderLen)
+    {
+        const int32_t len = buf->peekInt32();
+        if(len < 0 || static_cast<size_t>(len) > maxFrameLength_)
+        {
+            LOG_ERROR("LengthHeaderCodec::onMessage [%s] invalid length %d, shutdown \n",
+                      conn->name().c_str(), len);
+            buf->retrieveAll();
+            conn->shutdown();
+            break;
+        }
+
+        const size_t frameLen = kHeaderLen + len;
+        if(buf->readableBytes() < frameLen)
+        {
+            // 帧还不完整，先把剩下的空间预留出来，后面的数据直接读进Buffer，不经过溢出缓冲区
+            // 长度头是对端给的，最多预留kMaxReadSizeHint，不按声明的长度一次分配
+            buf->ensureWriteableBytes(std::min(frameLen - buf->readableBytes(), Buffer::kMaxReadSizeHint));
+            break;
+        }
+
+        frameCallback_(conn, buf->peek() + kHeaderLen, len, receiveTime);
+        buf->retrieve(frameLen);
+    }
+}
+
+void LengthHeaderCodec::send(const TcpConnectionPtr& conn, Buffer* buf)
+{
+    const int32_t len = static_cast<int32_t>(buf->readableBytes());
+    if(buf->prependableBytes() >= kHeaderLen)
+    {
+        buf->prependInt32(len);
+        conn->send(buf);
+        return;
+    }
+    // 调用者已经用掉了预留空间（比如自己prepend过），只能拼接到一个新的Buffer中
+    Buffer framed;
+    framed.appendInt32(len);
+    framed.append(buf->peek(), buf->readableBytes());
+    buf->retrieveAll();
+    conn->send(&framed);
+}
+
+void LengthHeaderCodec::send(const TcpConnectionPtr& conn, const char* data, size_t len)
+{
+    Buffer buf;
+    buf.append(data, len);
+    send(conn, &buf);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+#include "TimeStamp.h"
+
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* 4字节长度头（网络字节序）+ 消息体的编解码器，包装在MessageCallback外面
+* 解码：一次readFd收到的多个完整帧在同一次onMessage中依次交给用户，帧以指针+长度的形式指向Buffer内部，不拷贝
+* 编码：消息体直接写进Buffer，长度头写在Buffer的kCheapPrepend预留区域，不需要再拼接一个新的std::string
+* 用法：server.setMessageCallback(std::bind(&LengthHeaderCodec::onMessage, &codec, _1, _2, _3));
+*/
+class LengthHeaderCodec : noncopyable
+{
+public:
+    // data不包含长度头，只在回调期间有效
+    using FrameCallback = std::function<void(const TcpConnectionPtr&, const char* data, size_t len, TimeStamp)>;
+
+    static const size_t kHeaderLen = sizeof(int32_t);
+    static const size_t kDefaultMaxFrameLength = 64 * 1024 * 1024;
+
+    explicit LengthHeaderCodec(const FrameCallback& cb, size_t maxFrameLength = kDefaultMaxFrameLength);
+
+    void setMaxFrameLength(size_t maxFrameLength) { maxFrameLength_ = maxFrameLength; }
+    size_t maxFrameLength() const { return maxFrameLength_; }
+
+    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, TimeStamp receiveTime);
+
+    // buf中所有可读的数据作为一帧的消息体，在前面写入长度头以后发送，发送完buf被清空
+    void send(const TcpConnectionPtr& conn, Buffer* buf);
+    void send(const TcpConnectionPtr& conn, const char* data, size_t len);
+
+private:
+    FrameCallback frameCallback_;
+    size_t maxFrameLength_;
+};
@@ -0,0 +1,64 @@
+#include "LineCodec.h"
+#include "Buffer.h"
+#include "TcpConnection.h"
+#include "Logger.h"
+
+const size_t LineCodec::kDefaultMaxLineLength;
+
+LineCodec::LineCodec(const LineCallback& cb, size_t maxLineLength)
+    : lineCallback_(cb)
+    , maxLineLength_(maxLineLength)
+{
+}
+
+void LineCodec::onMessage(const TcpConnectionPtr& conn, Buffer* buf, TimeStamp receiveTime)
+{
+    if(!conn->connected())
+    {
+        // 已经因为超长关闭了（或者正在关闭），后面的数据不再解析
+        buf->retrieveAll();
+        return;
+    }
+
+    while(buf->readableBytes() > 0)
+    {
+        const char* start = buf->peek();
+        const char* eol = buf->findEOL();
+        if(eol == nullptr)
+        {
+            // 还没有收到完整的一行，最长的合法行加上"\r"还放不下，说明超长了
+            if(buf->readableBytes() > maxLineLength_ + 1)
+            {
+                handleOverflow(conn, buf);
+            }
+            break;
+        }
+
+        size_t len = eol - start;
+        if(len > 0 && start[len - 1] == '\r')
+        {
+            --len;
+        }
+        if(len > maxLineLength_)
+        {
+            handleOverflow(conn, buf);
+            break;
+        }
+
+        lineCallback_(conn, start, len, receiveTime);
+        buf->retrieve(eol + 1 - start);
+    }
+}
+
+void LineCodec::handleOverflow(const TcpConnectionPtr& conn, Buffer* buf)
+{
+    if(overflowCallback_)
+    {
+        overflowCallback_(conn, buf);
+        return;
+    }
+    LOG_ERROR("LineCodec::onMessage [%s] line exceeds %zu bytes, shutdown \n",
+              conn->name().c_str(), maxLineLength_);
+    buf->retrieveAll();
+    conn->shutdown();
+}
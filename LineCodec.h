@@ -0,0 +1,41 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+#include "TimeStamp.h"
+
+#include <functional>
+#include <stddef.h>
+
+/*
+* 按行拆分的编解码器，包装在MessageCallback外面，用于Redis风格的文本协议
+* 行以'\n'结尾，前面紧跟的'\r'会被去掉，所以"\n"和"\r\n"都可以
+* 每个完整的行以指针+长度的形式交给用户，指向Buffer内部，不拷贝成std::string，只在回调期间有效
+* 用法：server.setMessageCallback(std::bind(&LineCodec::onMessage, &codec, _1, _2, _3));
+*/
+class LineCodec : noncopyable
+{
+public:
+    using LineCallback = std::function<void(const TcpConnectionPtr&, const char* line, size_t len, TimeStamp)>;
+    // 一行超过最大长度时的回调，Buffer中是还没有处理的数据
+    using OverflowCallback = std::function<void(const TcpConnectionPtr&, Buffer*)>;
+
+    static const size_t kDefaultMaxLineLength = 64 * 1024;
+
+    explicit LineCodec(const LineCallback& cb, size_t maxLineLength = kDefaultMaxLineLength);
+
+    // 默认的处理是打印错误日志，丢弃缓冲区中的数据，关闭连接
+    void setOverflowCallback(const OverflowCallback& cb) { overflowCallback_ = cb; }
+    // 不包括行尾的"\r\n"
+    void setMaxLineLength(size_t maxLineLength) { maxLineLength_ = maxLineLength; }
+    size_t maxLineLength() const { return maxLineLength_; }
+
+    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, TimeStamp receiveTime);
+
+private:
+    void handleOverflow(const TcpConnectionPtr& conn, Buffer* buf);
+
+    LineCallback lineCallback_;
+    OverflowCallback overflowCallback_;
+    size_t maxLineLength_;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* 一个EventLoop上的负载计数：连接数和收发的字节数，EventLoopThreadPool选择loop时读取
+* 连接从创建（分配给这个loop）开始计数，一批连接还没有在loop中建立时也能看到，这个计数可以在任意线程修改
+* 字节数只在loop线程写（单写者，用load+store代替原子的读-改-写，没有lock前缀的开销），任意线程都可以读
+*/
+class LoopLoad : noncopyable
+{
+public:
+    LoopLoad()
+        : connections_(0)
+        , bytes_(0)
+    {
+    }
+
+    // 任意线程
+    void connectionAdded() { connections_.fetch_add(1, std::memory_order_relaxed); }
+    void connectionRemoved() { connections_.fetch_sub(1, std::memory_order_relaxed); }
+    // 只能在loop线程调用
+    void addBytes(size_t n) { bytes_.store(bytes_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+    int64_t connections() const { return connections_.load(std::memory_order_relaxed); }
+    // 累计收发的字节数，两次采样做差得到吞吐
+    uint64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> connections_;
+    std::atomic<uint64_t> bytes_;
+};
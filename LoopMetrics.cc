@@ -0,0 +1,117 @@
+#include "LoopMetrics.h"
+
+#include <time.h>
+
+LogHistogram::LogHistogram()
+    : count_(0)
+    , sum_(0)
+    , max_(0)
+{
+    for(int i = 0; i < kBuckets; ++i)
+    {
+        buckets_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void LogHistogram::record(uint64_t value)
+{
+    add(buckets_[bucketOf(value)], 1);
+    add(count_, 1);
+    add(sum_, value);
+    if(value > max_.load(std::memory_order_relaxed))
+    {
+        max_.store(value, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LogHistogram::bucketUpperBound(int idx)
+{
+    if(idx >= 64)
+    {
+        return UINT64_MAX;
+    }
+    return static_cast<uint64_t>(1) << idx;
+}
+
+uint64_t LogHistogram::percentile(double p) const
+{
+    uint64_t total = count();
+    if(total == 0)
+    {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(p * total);
+    uint64_t seen = 0;
+    for(int i = 0; i < kBuckets; ++i)
+    {
+        seen += bucketCount(i);
+        if(seen > target)
+        {
+            return bucketUpperBound(i);
+        }
+    }
+    return max();
+}
+
+LoopMetrics::LoopMetrics()
+    : windowBusyNs_(0)
+    , windowTotalNs_(0)
+    , recentUtilization_(0.0)
+    , recentAtNs_(nowNs())
+    , busySinceNs_(0)
+{
+}
+
+void LoopMetrics::recordIteration(int64_t pollNs, int64_t dispatchNs, int64_t functorsNs,
+                                  size_t activeChannels, size_t pendingFunctors)
+{
+    pollWaitNs_.record(pollNs);
+    dispatchNs_.record(dispatchNs);
+    functorsNs_.record(functorsNs);
+    activeChannels_.record(activeChannels);
+    pendingFunctors_.record(pendingFunctors);
+
+    windowBusyNs_ += dispatchNs + functorsNs;
+    windowTotalNs_ += pollNs + dispatchNs + functorsNs;
+    if(windowTotalNs_ >= static_cast<uint64_t>(kWindowNs))
+    {
+        recentUtilization_.store(static_cast<double>(windowBusyNs_) / windowTotalNs_, std::memory_order_relaxed);
+        recentAtNs_.store(nowNs(), std::memory_order_relaxed);
+        windowBusyNs_ = 0;
+        windowTotalNs_ = 0;
+    }
+    busySinceNs_.store(0, std::memory_order_relaxed);
+}
+
+double LoopMetrics::utilization() const
+{
+    uint64_t total = totalNs();
+    return total == 0 ? 0.0 : static_cast<double>(busyNs()) / total;
+}
+
+double LoopMetrics::recentUtilization() const
+{
+    // 卡在一个很慢的handler中的loop不会结束窗口，但它才是最忙的，不能当成空闲
+    if(busyForNs() >= kWindowNs)
+    {
+        return 1.0;
+    }
+    if(nowNs() - recentAtNs_.load(std::memory_order_relaxed) > kStaleNs)
+    {
+        return 0.0;
+    }
+    return recentUtilization_.load(std::memory_order_relaxed);
+}
+
+int64_t LoopMetrics::busyForNs() const
+{
+    int64_t since = busySinceNs_.load(std::memory_order_relaxed);
+    return since == 0 ? 0 : nowNs() - since;
+}
+
+int64_t LoopMetrics::nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
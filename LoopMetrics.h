@@ -0,0 +1,104 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* 按2的幂分桶的直方图，第i个桶记录[2^(i-1), 2^i)范围内的值，第0个桶记录0
+* 只允许一个线程（loop线程）写，任意线程都可以读，读到的是近似一致的快照
+*/
+class LogHistogram : noncopyable
+{
+public:
+    static const int kBuckets = 65;
+
+    LogHistogram();
+
+    // 只能在写线程调用
+    void record(uint64_t value);
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    uint64_t bucketCount(int idx) const { return buckets_[idx].load(std::memory_order_relaxed); }
+
+    // 第idx个桶的上界（不包含）
+    static uint64_t bucketUpperBound(int idx);
+    // 返回第p(0~1)分位所在桶的上界，精度是2倍
+    uint64_t percentile(double p) const;
+
+private:
+    static int bucketOf(uint64_t value)
+    {
+        return value == 0 ? 0 : 64 - __builtin_clzll(value);
+    }
+
+    // 单线程写，用load+store代替原子的读-改-写
+    static void add(std::atomic<uint64_t>& counter, uint64_t delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets_[kBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+/*
+* EventLoop每一轮循环的统计：poll阻塞时间、处理Channel事件的时间、执行回调的时间、
+* 每轮活跃的channel数以及待执行回调的个数
+* 时间单位都是纳秒
+*/
+class LoopMetrics : noncopyable
+{
+public:
+    LoopMetrics();
+
+    // loop线程在poll返回以后调用，记下这一轮开始处理事件的时间，recordIteration时清除
+    void beginDispatch(int64_t startNs) { busySinceNs_.store(startNs, std::memory_order_relaxed); }
+    void recordIteration(int64_t pollNs, int64_t dispatchNs, int64_t functorsNs,
+                         size_t activeChannels, size_t pendingFunctors);
+
+    const LogHistogram& pollWaitNs() const { return pollWaitNs_; }
+    const LogHistogram& dispatchNs() const { return dispatchNs_; }
+    const LogHistogram& functorsNs() const { return functorsNs_; }
+    const LogHistogram& activeChannels() const { return activeChannels_; }
+    const LogHistogram& pendingFunctors() const { return pendingFunctors_; }
+
+    uint64_t iterations() const { return pollWaitNs_.count(); }
+    // 处理事件和回调的总时间
+    uint64_t busyNs() const { return dispatchNs_.sum() + functorsNs_.sum(); }
+    // loop运行的总时间
+    uint64_t totalNs() const { return pollWaitNs_.sum() + busyNs(); }
+    // loop利用率 busy / total，两次采样的busyNs/totalNs做差就是这段时间内的利用率
+    double utilization() const;
+    // 最近一个采样窗口（kWindowNs）的利用率，可以在任意线程读取
+    // 窗口在每轮结束时才结算：这一轮已经处理了超过一个窗口（卡在很慢的回调里）时返回1，
+    // 阻塞在poll中超过kStaleNs没有更新时按空闲处理，返回0
+    double recentUtilization() const;
+    // 这一轮已经连续处理了多久的事件和回调，阻塞在poll中时返回0，可以在任意线程读取
+    int64_t busyForNs() const;
+
+    // 单调时钟，纳秒
+    static int64_t nowNs();
+
+private:
+    static const int64_t kWindowNs = 100 * 1000 * 1000;
+    static const int64_t kStaleNs = 1000 * 1000 * 1000;
+
+    LogHistogram pollWaitNs_;
+    LogHistogram dispatchNs_;
+    LogHistogram functorsNs_;
+    LogHistogram activeChannels_;
+    LogHistogram pendingFunctors_;
+
+    uint64_t windowBusyNs_;     // 当前窗口累计的时间，只有loop线程读写
+    uint64_t windowTotalNs_;
+    std::atomic<double> recentUtilization_;
+    std::atomic<int64_t> recentAtNs_;   // 上一个窗口结束的时间
+    std::atomic<int64_t> busySinceNs_;  // 这一轮开始处理事件的时间，在poll中时为0
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <atomic>
+#include <stddef.h>
+
+// 缓存行大小，被多个线程频繁读写的原子变量放到不同的缓存行上，避免伪共享
+const size_t kCacheLineSize = 64;
+
+/*
+* 侵入式的无锁多生产者单消费者队列（Vyukov MPSC）
+* T需要有一个 std::atomic<T*> next_ 成员，并且可以默认构造（用作哨兵节点）
+* push可以在任意线程调用，只有一次原子交换，不会失败重试
+* pop/empty只能在消费者线程（EventLoop所在的线程）调用
+*/
+template <typename T>
+class MpscQueue : noncopyable
+{
+public:
+    MpscQueue()
+        : head_(&stub_)
+        , tail_(&stub_)
+    {
+        stub_.next_.store(nullptr, std::memory_order_relaxed);
+    }
+
+    // 生产者：把node挂到队尾
+    void push(T* node)
+    {
+        node->next_.store(nullptr, std::memory_order_relaxed);
+        T* prev = head_.exchange(node, std::memory_order_acq_rel);
+        // 在这两步之间，消费者暂时看不到node以及之后的节点，pop会返回nullptr
+        prev->next_.store(node, std::memory_order_release);
+    }
+
+    // 消费者：取出队头，队列为空（或者有生产者正在push）时返回nullptr
+    T* pop()
+    {
+        T* tail = tail_;
+        T* next = tail->next_.load(std::memory_order_acquire);
+        if(tail == &stub_)
+        {
+            if(next == nullptr)
+            {
+                return nullptr;
+            }
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+
+        if(next != nullptr)
+        {
+            tail_ = next;
+            return tail;
+        }
+
+        T* head = head_.load(std::memory_order_acquire);
+        if(tail != head)
+        {
+            // 有生产者正在push，还没有链接上
+            return nullptr;
+        }
+
+        // tail是最后一个节点，把哨兵重新挂到队尾，才能把tail取出来
+        push(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if(next != nullptr)
+        {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    // 消费者：队列中是否没有节点，只看消费者这一端
+    // 不能用head_ == &stub_判断：pop把哨兵重新挂到队尾时，可能有生产者刚交换了head_还没有链接上，
+    // 这时head_是哨兵，前面却还有没取出的节点
+    // 有生产者正在push时也返回true，这个生产者push完以后会自己唤醒消费者
+    bool empty() const
+    {
+        return tail_ == &stub_ && stub_.next_.load(std::memory_order_acquire) == nullptr;
+    }
+
+private:
+    alignas(kCacheLineSize) std::atomic<T*> head_;  // 生产者竞争的队尾
+    alignas(kCacheLineSize) T* tail_;               // 只有消费者访问的队头
+    T stub_;                                        // 哨兵节点
+};
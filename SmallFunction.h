@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+template <typename Signature, size_t Capacity = 64>
+class SmallFunction;
+
+/*
+* 只能移动的可调用对象，和std::function用法一样，但是内部有Capacity字节的缓冲区
+* std::bind(&TcpConnection::xxx, this, conn)这类捕获了shared_ptr的对象超过了std::function的小对象缓冲区，每次构造都要分配堆内存，
+* 放到这里可以直接就地构造，不分配内存；超过Capacity的对象才退回到堆上
+* 不支持拷贝，捕获的状态只会被移动，避免了shared_ptr引用计数的额外增减
+*/
+template <typename R, typename... Args, size_t Capacity>
+class SmallFunction<R(Args...), Capacity>
+{
+public:
+    SmallFunction() : ops_(nullptr) {}
+    SmallFunction(std::nullptr_t) : ops_(nullptr) {}
+
+    template <typename F,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, SmallFunction>::value>::type>
+    SmallFunction(F&& f)
+        : ops_(nullptr)
+    {
+        assign(std::forward<F>(f));
+    }
+
+    SmallFunction(SmallFunction&& other)
+        : ops_(nullptr)
+    {
+        moveFrom(other);
+    }
+
+    SmallFunction& operator=(SmallFunction&& other)
+    {
+        if(this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    SmallFunction& operator=(std::nullptr_t)
+    {
+        reset();
+        return *this;
+    }
+
+    template <typename F,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, SmallFunction>::value>::type>
+    SmallFunction& operator=(F&& f)
+    {
+        reset();
+        assign(std::forward<F>(f));
+        return *this;
+    }
+
+    SmallFunction(const SmallFunction&) = delete;
+    SmallFunction& operator=(const SmallFunction&) = delete;
+
+    ~SmallFunction() { reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    R operator()(Args... args) const
+    {
+        return ops_->invoke(const_cast<void*>(static_cast<const void*>(&storage_)), std::forward<Args>(args)...);
+    }
+
+    // 可调用对象是否放在内部缓冲区中（没有分配堆内存）
+    template <typename F>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(F) <= Capacity
+            && alignof(F) <= alignof(Storage)
+            && std::is_nothrow_move_constructible<F>::value;
+    }
+
+private:
+    using Storage = typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type;
+
+    // 每种可调用对象类型对应一组静态的操作函数
+    struct Ops
+    {
+        R (*invoke)(void* storage, Args&&... args);
+        void (*move)(void* dst, void* src);   // 把src中的对象移动到dst，并销毁src中的对象
+        void (*destroy)(void* storage);
+    };
+
+    template <typename F>
+    struct InlineOps
+    {
+        static R invoke(void* s, Args&&... args)
+        {
+            return (*static_cast<F*>(s))(std::forward<Args>(args)...);
+        }
+        static void move(void* dst, void* src)
+        {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* s)
+        {
+            static_cast<F*>(s)->~F();
+        }
+        static const Ops ops;
+    };
+
+    template <typename F>
+    struct HeapOps
+    {
+        static F*& ptr(void* s) { return *static_cast<F**>(s); }
+        static R invoke(void* s, Args&&... args)
+        {
+            return (*ptr(s))(std::forward<Args>(args)...);
+        }
+        static void move(void* dst, void* src)
+        {
+            new (dst) F*(ptr(src));
+        }
+        static void destroy(void* s)
+        {
+            delete ptr(s);
+        }
+        static const Ops ops;
+    };
+
+    template <typename F>
+    void assign(F&& f)
+    {
+        using Fn = typename std::decay<F>::type;
+        if(isEmpty(f))
+        {
+            return;
+        }
+        // 编译期选择分支，放不下的类型不会实例化内联存储的placement new
+        emplace<Fn>(std::forward<F>(f), std::integral_constant<bool, fitsInline<Fn>()>());
+    }
+
+    template <typename Fn, typename F>
+    void emplace(F&& f, std::true_type)
+    {
+        new (&storage_) Fn(std::forward<F>(f));
+        ops_ = &InlineOps<Fn>::ops;
+    }
+
+    template <typename Fn, typename F>
+    void emplace(F&& f, std::false_type)
+    {
+        new (&storage_) Fn*(new Fn(std::forward<F>(f)));
+        ops_ = &HeapOps<Fn>::ops;
+    }
+
+    void moveFrom(SmallFunction& other)
+    {
+        if(other.ops_ != nullptr)
+        {
+            other.ops_->move(&storage_, &other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    void reset()
+    {
+        if(ops_ != nullptr)
+        {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    // 空的std::function、函数指针当作空对象处理，和std::function的行为一致
+    template <typename F>
+    static bool isEmpty(const F&) { return false; }
+    template <typename Sig>
+    static bool isEmpty(const std::function<Sig>& f) { return !f; }
+    template <typename Ret, typename... A>
+    static bool isEmpty(Ret (*const& f)(A...)) { return f == nullptr; }
+
+    const Ops* ops_;
+    Storage storage_;
+};
+
+template <typename R, typename... Args, size_t Capacity>
+template <typename F>
+const typename SmallFunction<R(Args...), Capacity>::Ops
+SmallFunction<R(Args...), Capacity>::InlineOps<F>::ops = {
+    &InlineOps<F>::invoke, &InlineOps<F>::move, &InlineOps<F>::destroy
+};
+
+template <typename R, typename... Args, size_t Capacity>
+template <typename F>
+const typename SmallFunction<R(Args...), Capacity>::Ops
+SmallFunction<R(Args...), Capacity>::HeapOps<F>::ops = {
+    &HeapOps<F>::invoke, &HeapOps<F>::move, &HeapOps<F>::destroy
+};
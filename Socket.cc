@@ -8,6 +8,10 @@
 #include <string.h>
 #include <netinet/tcp.h>
 
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
 Socket::~Socket()
 {
     close(sockfd_);
@@ -92,6 +96,27 @@ void Socket::setReusePort(bool on)
     }
 }
 
+// 设置SO_BUSY_POLL，阻塞读的时候在驱动队列上忙轮询usec微秒，降低延迟（超过net.core.busy_read需要CAP_NET_ADMIN）
+void Socket::setBusyPoll(int usec)
+{
+    if(setsockopt(sockfd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof usec) < 0)
+    {
+        LOG_ERROR("setBusyPoll failed");
+    }
+}
+
+// 设置SO_ZEROCOPY，之后send可以带MSG_ZEROCOPY标志，发送完成的通知放在socket的错误队列中
+bool Socket::setZeroCopy(bool on)
+{
+    int optval = on ? 1 : 0;
+    if(setsockopt(sockfd_, SOL_SOCKET, SO_ZEROCOPY, &optval, sizeof optval) < 0)
+    {
+        LOG_ERROR("setZeroCopy failed");
+        return false;
+    }
+    return true;
+}
+
 // 设置SO_KEEPALIVE，开启TCP保活机制，检测死连接
 void Socket::setKeepAlive(bool on)
 {
@@ -20,6 +20,8 @@ public:
     void setReuseAddr(bool on);
     void setReusePort(bool on);
     void setKeepAlive(bool on);
+    void setBusyPoll(int usec);
+    bool setZeroCopy(bool on);  // SO_ZEROCOPY，内核不支持时返回false
 
 private:
     const int sockfd_;
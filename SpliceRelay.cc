@@ -0,0 +1,376 @@
+#include "SpliceRelay.h"
+#include "TcpConnection.h"
+#include "EventLoop.h"
+#include "Channel.h"
+#include "Logger.h"
+
+#include <functional>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+std::shared_ptr<SpliceRelay> SpliceRelay::create(const TcpConnectionPtr& source,
+                                                 const TcpConnectionPtr& sink,
+                                                 size_t pipeSize)
+{
+    int fds[2];
+    if(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        LOG_ERROR("SpliceRelay::create pipe2 errno:%d \n", errno);
+        return std::shared_ptr<SpliceRelay>();
+    }
+    // 超过/proc/sys/fs/pipe-max-size时会失败，使用默认大小
+    ::fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(pipeSize));
+    return std::shared_ptr<SpliceRelay>(new SpliceRelay(source, sink, fds));
+}
+
+bool SpliceRelay::relay(const TcpConnectionPtr& a, const TcpConnectionPtr& b)
+{
+    std::shared_ptr<SpliceRelay> ab = create(a, b);
+    std::shared_ptr<SpliceRelay> ba = create(b, a);
+    if(!ab || !ba)
+    {
+        return false;
+    }
+    ab->start();
+    ba->start();
+    return true;
+}
+
+SpliceRelay::SpliceRelay(const TcpConnectionPtr& source, const TcpConnectionPtr& sink, int pipeFds[2])
+    : source_(source)
+    , sink_(sink)
+    , sourceLoop_(source->getLoop())
+    , sinkLoop_(sink->getLoop())
+    , pipeRead_(pipeFds[0])
+    , pipeWrite_(pipeFds[1])
+    , pipeCapacity_(kDefaultPipeSize)
+    , inPipe_(0)
+    , sourcePaused_(false)
+    , sourceEof_(false)
+    , sinkClosed_(false)
+    , bytesRelayed_(0)
+    , sinkShutdown_(false)
+{
+    int size = ::fcntl(pipeWrite_, F_GETPIPE_SZ);
+    if(size > 0)
+    {
+        pipeCapacity_ = size;
+    }
+}
+
+SpliceRelay::~SpliceRelay()
+{
+    ::close(pipeRead_);
+    ::close(pipeWrite_);
+}
+
+void SpliceRelay::start()
+{
+    // 先在sink的loop中登记，保证pump执行的时候sink已经知道自己是relay的目的端
+    sinkLoop_->runInLoop(std::bind(&SpliceRelay::attachSink, shared_from_this()));
+    sourceLoop_->runInLoop(std::bind(&SpliceRelay::attachSource, shared_from_this()));
+}
+
+void SpliceRelay::attachSink()
+{
+    TcpConnectionPtr sink = sink_.lock();
+    if(sink)
+    {
+        sink->relaySink_ = shared_from_this();
+    }
+}
+
+void SpliceRelay::attachSource()
+{
+    TcpConnectionPtr source = source_.lock();
+    if(!source)
+    {
+        onSourceClosed();
+        return;
+    }
+
+    // inputBuffer中还没有交给用户的数据先转发，之后的数据都走pipe
+    if(source->inputBuffer_.readableBytes() > 0)
+    {
+        TcpConnectionPtr sink = sink_.lock();
+        if(sink)
+        {
+            sink->send(&source->inputBuffer_);
+        }
+        source->inputBuffer_.retrieveAll();
+    }
+    // 在登记之前source就已经断开了，剩下的数据已经转发，直接按EOF处理
+    if(source->state_ == TcpConnection::kDisconnected)
+    {
+        onSourceClosed();
+        return;
+    }
+    source->relaySource_ = shared_from_this();
+    // ET模式下已经到达的数据不会再通知，直接读一次
+    onSourceReadable();
+}
+
+void SpliceRelay::onSourceReadable()
+{
+    TcpConnectionPtr source = source_.lock();
+    if(!source || source->state_ == TcpConnection::kDisconnected)
+    {
+        return;
+    }
+    if(sinkClosed_)
+    {
+        discardSource(source);
+        return;
+    }
+    if(sourcePaused_ || sourceEof_)
+    {
+        return;
+    }
+
+    int fd = source->channel_->fd();
+    while(!sinkClosed_)
+    {
+        ssize_t n = ::splice(fd, NULL, pipeWrite_, NULL, pipeCapacity_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n > 0)
+        {
+            source->addTransferred(n);
+            // pipe从空变成非空时才需要通知sink，其余时候sink的pump还在进行中
+            if(inPipe_.fetch_add(n) == 0)
+            {
+                schedulePump();
+            }
+        }
+        else if(n == 0)
+        {
+            sourceFinished(source);
+            return;
+        }
+        else if(errno == EINTR)
+        {
+            continue;
+        }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            // socket没数据或者pipe满了，socket中还有数据说明是pipe满了
+            int avail = 0;
+            if(::ioctl(fd, FIONREAD, &avail) == 0 && avail > 0)
+            {
+                pauseSource(source);
+            }
+            return;
+        }
+        else
+        {
+            LOG_ERROR("SpliceRelay::onSourceReadable splice errno:%d \n", errno);
+            source->handleError();
+            source->handleClose();
+            return;
+        }
+    }
+}
+
+void SpliceRelay::pauseSource(const TcpConnectionPtr& source)
+{
+    sourcePaused_ = true;
+    source->channel_->disableReading();
+    // sink可能在设置sourcePaused_之前就已经把pipe排空了，这时由自己恢复
+    if(inPipe_ == 0 && sourcePaused_.exchange(false))
+    {
+        sourceLoop_->queueInLoop(std::bind(&SpliceRelay::resumeSource, shared_from_this()));
+    }
+}
+
+void SpliceRelay::resumeSource()
+{
+    TcpConnectionPtr source = source_.lock();
+    if(!source || source->state_ == TcpConnection::kDisconnected || sourceEof_)
+    {
+        return;
+    }
+    if(!source->channel_->isReading())
+    {
+        source->channel_->enableReading();
+    }
+    onSourceReadable();
+}
+
+// 对端关闭了写端，pipe中的数据发送完以后shutdown sink
+void SpliceRelay::sourceFinished(const TcpConnectionPtr& source)
+{
+    source->channel_->disableReading();
+    sourceEof_ = true;
+    schedulePump();
+    // source的写方向不再被反向的relay使用（或者已经shutdown了）就可以直接关闭连接
+    // 否则等反向的relay shutdown它的时候在shutdownInLoop中关闭
+    if(!source->relaySink_ ||
+       (source->state_ == TcpConnection::kDisconnecting && !source->hasPendingOutput()))
+    {
+        source->handleClose();
+    }
+}
+
+// source暂停读的时候对端关闭，两个方向都关闭了会收到EPOLLHUP，这时socket中可能还有没转发的数据
+// 先不关闭连接，等恢复读以后读到EOF再关闭
+bool SpliceRelay::deferSourceClose() const
+{
+    TcpConnectionPtr source = source_.lock();
+    if(!source || sourceEof_ || sinkClosed_)
+    {
+        return false;
+    }
+    int avail = 0;
+    return ::ioctl(source->channel_->fd(), FIONREAD, &avail) == 0 && avail > 0;
+}
+
+void SpliceRelay::onSourceClosed()
+{
+    sourceEof_ = true;
+    schedulePump();
+}
+
+// sink已经断开，source不能再转发了，读到的数据丢弃直到对端关闭
+// source同时是反向relay的sink时写方向由反向的relay在pipe排空以后shutdown，否则在这里shutdown
+void SpliceRelay::stopSource()
+{
+    TcpConnectionPtr source = source_.lock();
+    if(!source || source->state_ == TcpConnection::kDisconnected)
+    {
+        return;
+    }
+    if(!source->relaySink_)
+    {
+        if(sourceEof_)
+        {
+            source->handleClose();
+            return;
+        }
+        source->shutdown();
+    }
+    if(sourceEof_)
+    {
+        return;
+    }
+    sourcePaused_ = false;
+    if(!source->channel_->isReading())
+    {
+        source->channel_->enableReading();
+    }
+    discardSource(source);
+}
+
+void SpliceRelay::discardSource(const TcpConnectionPtr& source)
+{
+    Buffer& buf = source->inputBuffer_;
+    int savedErrno = 0;
+    while(true)
+    {
+        ssize_t n = buf.readFd(source->channel_->fd(), &savedErrno);
+        buf.retrieveAll();
+        if(n > 0)
+        {
+            continue;
+        }
+        if(n == 0)
+        {
+            sourceFinished(source);
+        }
+        else if(savedErrno == EINTR)
+        {
+            continue;
+        }
+        else if(savedErrno != EAGAIN && savedErrno != EWOULDBLOCK)
+        {
+            source->handleClose();
+        }
+        return;
+    }
+}
+
+void SpliceRelay::schedulePump()
+{
+    sinkLoop_->runInLoop(std::bind(&SpliceRelay::pump, shared_from_this()));
+}
+
+void SpliceRelay::onSinkWritable()
+{
+    pump();
+}
+
+void SpliceRelay::onSinkClosed()
+{
+    if(!sinkClosed_.exchange(true))
+    {
+        sourceLoop_->runInLoop(std::bind(&SpliceRelay::stopSource, shared_from_this()));
+    }
+}
+
+// 在sink的loop中把pipe中的数据发送出去，一直到pipe排空或者sink的发送缓冲区满了
+void SpliceRelay::pump()
+{
+    TcpConnectionPtr sink = sink_.lock();
+    if(!sink || sink->state_ == TcpConnection::kDisconnected || sinkClosed_)
+    {
+        return;
+    }
+    // 先发送sink发送缓冲区中已有的数据，保证顺序，发送完以后handleWrite会再调用过来
+    if(sink->hasPendingOutput())
+    {
+        if(!sink->channel_->isWriting())
+        {
+            sink->channel_->enableWriting();
+        }
+        return;
+    }
+
+    int fd = sink->channel_->fd();
+    // 最多只取计数过的字节数，source可能已经splice进pipe但是还没有加上计数
+    size_t avail = inPipe_;
+    while(avail > 0)
+    {
+        ssize_t n = ::splice(pipeRead_, NULL, fd, NULL, avail, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n > 0)
+        {
+            bytesRelayed_.fetch_add(n, std::memory_order_relaxed);
+            sink->addTransferred(n);
+            avail = inPipe_.fetch_sub(n) - n;
+        }
+        else if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // socket发送缓冲区满了，等EPOLLOUT
+            if(!sink->channel_->isWriting())
+            {
+                sink->channel_->enableWriting();
+            }
+            return;
+        }
+        else
+        {
+            LOG_ERROR("SpliceRelay::pump splice errno:%d \n", n < 0 ? errno : 0);
+            sink->handleError();
+            sink->handleClose();
+            return;
+        }
+    }
+
+    // pipe排空了
+    if(!sink->edgeTriggered_ && sink->channel_->isWriting())
+    {
+        sink->channel_->disableWriting();
+    }
+    if(sourcePaused_.exchange(false))
+    {
+        sourceLoop_->runInLoop(std::bind(&SpliceRelay::resumeSource, shared_from_this()));
+    }
+    // 读到sourceEof_以后要再确认一次pipe是空的，EOF之前最后一次splice的数据可能还没排空
+    if(sourceEof_ && inPipe_ == 0 && !sinkShutdown_)
+    {
+        sinkShutdown_ = true;
+        sink->shutdown();
+    }
+}
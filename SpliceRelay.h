@@ -0,0 +1,76 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "Callbacks.h"
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <stddef.h>
+
+class EventLoop;
+
+/*
+* 用pipe + splice(2)把一个TcpConnection收到的数据转发给另一个TcpConnection（单向），数据不经过用户态
+* 两个连接可以在不同的EventLoop上：从source读进pipe在source的loop中做，从pipe写到sink在sink的loop中做
+* 背压：pipe满了关闭source的EPOLLIN，sink的发送缓冲区满了打开sink的EPOLLOUT，pipe排空以后再恢复source
+* 半关闭：source读到EOF，pipe排空以后shutdown sink的写端；sink断开以后停止读source并shutdown source
+* 连接持有relay，relay只持有连接的weak_ptr
+*/
+class SpliceRelay : noncopyable, public std::enable_shared_from_this<SpliceRelay>
+{
+public:
+    static const size_t kDefaultPipeSize = 1024 * 1024;
+
+    // 创建source -> sink的转发，pipe创建失败返回nullptr，可以在任意线程调用
+    static std::shared_ptr<SpliceRelay> create(const TcpConnectionPtr& source,
+                                               const TcpConnectionPtr& sink,
+                                               size_t pipeSize = kDefaultPipeSize);
+    // 双向转发a <-> b，用于四层代理，成功返回true
+    static bool relay(const TcpConnectionPtr& a, const TcpConnectionPtr& b);
+
+    ~SpliceRelay();
+
+    // 开始转发，之后source的数据不再交给MessageCallback，source的inputBuffer中已有的数据会先发送给sink
+    // 可以在任意线程调用
+    void start();
+
+    // 已经转发的字节数，可以在任意线程读取
+    uint64_t bytesRelayed() const { return bytesRelayed_.load(std::memory_order_relaxed); }
+    bool sourceEof() const { return sourceEof_; }
+
+    // 以下由TcpConnection调用
+    void onSourceReadable();    // source的loop线程
+    void onSourceClosed();      // source的loop线程
+    bool deferSourceClose() const;  // source的loop线程，EPOLLHUP时还有没转发的数据返回true
+    void onSinkWritable();      // sink的loop线程
+    void onSinkClosed();        // sink的loop线程
+
+private:
+    SpliceRelay(const TcpConnectionPtr& source, const TcpConnectionPtr& sink, int pipeFds[2]);
+
+    void attachSource();
+    void attachSink();
+    void pauseSource(const TcpConnectionPtr& source);
+    void resumeSource();
+    void stopSource();
+    void discardSource(const TcpConnectionPtr& source);
+    void sourceFinished(const TcpConnectionPtr& source);
+    void schedulePump();
+    void pump();
+
+    std::weak_ptr<TcpConnection> source_;
+    std::weak_ptr<TcpConnection> sink_;
+    EventLoop* sourceLoop_;
+    EventLoop* sinkLoop_;
+    int pipeRead_;
+    int pipeWrite_;
+    size_t pipeCapacity_;
+
+    std::atomic<size_t> inPipe_;        // pipe中的字节数，source加，sink减
+    std::atomic<bool> sourcePaused_;    // pipe满了，source停止读，等sink排空以后恢复
+    std::atomic<bool> sourceEof_;       // source已经读到EOF（或者断开），pipe排空以后shutdown sink
+    std::atomic<bool> sinkClosed_;      // sink已经断开，source的数据直接丢弃
+    std::atomic<uint64_t> bytesRelayed_;
+    bool sinkShutdown_;                 // 只在sink的loop线程访问
+};
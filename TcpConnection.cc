@@ -4,6 +4,8 @@
 #include "Channel.h"
 #include "EventLoop.h"
 #include "Buffer.h"
+#include "SpliceRelay.h"
+#include "Upgrade.h"
 
 #include <functional>
 #include <errno.h>
@@ -12,7 +14,11 @@
 #include <strings.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <string>
+#include <algorithm>
 
 static EventLoop* CheckLoopNotNull(EventLoop* loop)
 {
@@ -28,23 +34,37 @@ TcpConnection::TcpConnection(EventLoop* loop,
                 const std::string& name,
                 int sockfd,
                 const InetAddress& localAddr,
-                const InetAddress& peerAddr)
+                const InetAddress& peerAddr,
+                uint64_t id)
     :loop_(CheckLoopNotNull(loop))
     , name_(name)
+    , id_(id)
     , state_(kConnecting)
     , reading_(true)
+    , edgeTriggered_(false)
+    , chainedOutput_(false)
     , socket_(new Socket(sockfd))
     , channel_(new Channel(loop,sockfd))
     , localAddr_(localAddr)
     , peerAddr_(peerAddr)
     , highWaterMark_(64*1024*1024)  // 64M
+    , inputBuffer_(Buffer::kInitialSize, loop->bufferPool())
+    , outputBuffer_(Buffer::kInitialSize, loop->bufferPool())
+    , zeroCopyThreshold_(0)
+    , autoCork_(false)
+    , corkScheduled_(false)
+    , flushDeadlineUs_(0)
+    , idleTimeoutSec_(0)
+    , idleWheel_(nullptr)
+    , handedOff_(false)
 {
     // 给chnannel设置回调函数
     channel_->setReadCallback(std::bind(&TcpConnection::handleRead,this,std::placeholders::_1));
     channel_->setWriteCallback(std::bind(&TcpConnection::handleWrite,this));
-    channel_->setCloseCallback(std::bind(&TcpConnection::handleClose,this));
-    channel_->setErrorCallback(std::bind(&TcpConnection::handleClose,this));
+    channel_->setCloseCallback(std::bind(&TcpConnection::handleCloseEvent,this));
+    channel_->setErrorCallback(std::bind(&TcpConnection::handleErrorEvent,this));
 
+    loop_->load().connectionAdded();  // 在connectDestroyed中减掉
     LOG_INFO("TcpConnection::ctor[%s] at fd=%d\n", name_.c_str(), sockfd);
     socket_->setKeepAlive(true);
 }
@@ -53,6 +73,13 @@ TcpConnection::~TcpConnection()
 {
     LOG_INFO("TcpConnection::dtor[%s] at fd=%d state=%d \n", 
         name_.c_str(), channel_->fd(), (int)state_);
+    for(const PendingChunk& chunk : pendingChunks_)
+    {
+        if(chunk.fd >= 0)
+        {
+            ::close(chunk.fd);
+        }
+    }
 }
 
 // 发送数据
@@ -66,16 +93,82 @@ void TcpConnection::send(const std::string &buf)
         }
         else
         {
-            // 放在loop的线程中执行
+            // 放在loop的线程中执行，调用者的buf在返回以后就可能失效，拷贝一份跟着回调走，并持有连接直到发送
+            loop_->runInLoop(std::bind(
+                &TcpConnection::sendStringInLoop,
+                shared_from_this(),
+                buf)
+            );
+        }
+    }
+}
+
+void TcpConnection::send(std::string &&buf)
+{
+    if(state_ == kConnected)
+    {
+        if(loop_->isInLoopThread())
+        {
+            sendInLoop(buf.data(),buf.size());
+        }
+        else
+        {
+            // 字符串移动到回调中，不拷贝数据
+            loop_->runInLoop(std::bind(
+                &TcpConnection::sendStringInLoop,
+                shared_from_this(),
+                std::move(buf))
+            );
+        }
+    }
+}
+
+void TcpConnection::send(const void* data, size_t len)
+{
+    if(state_ == kConnected)
+    {
+        if(loop_->isInLoopThread())
+        {
+            sendInLoop(data,len);
+        }
+        else
+        {
+            send(std::string(static_cast<const char*>(data),len));
+        }
+    }
+}
+
+void TcpConnection::send(Buffer* buf)
+{
+    if(state_ == kConnected)
+    {
+        if(loop_->isInLoopThread())
+        {
+            sendInLoop(buf->peek(),buf->readableBytes());
+            buf->retrieveAll();
+        }
+        else
+        {
+            // 整个Buffer的存储移动到回调中，调用者的buf变成空的，下次写入时再分配
             loop_->runInLoop(std::bind(
-                &TcpConnection::sendInLoop,
-                this,
-                buf.c_str(),
-                buf.size())
+                &TcpConnection::sendBufferInLoop,
+                shared_from_this(),
+                std::move(*buf))
             );
         }
     }
 }
+
+void TcpConnection::sendBufferInLoop(Buffer& buf)
+{
+    sendInLoop(buf.peek(),buf.readableBytes());
+}
+
+void TcpConnection::sendStringInLoop(const std::string& message)
+{
+    sendInLoop(message.data(),message.size());
+}
+
 /**
  * 发送数据  应用写的快， 而内核发送数据慢， 需要把待发送数据写入缓冲区， 而且设置了水位回调（防止发送太快）
  */ 
@@ -91,12 +184,33 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
         return;
     }
 
-    if(!channel_->isWriting() && outputBuffer_.readableBytes() == 0)
+    if(autoCork_ && state_ == kConnected)
+    {
+        // 先攒在发送缓冲区中，本轮事件处理完以后统一发送
+        size_t oldlen = outputBytes();
+        if(oldlen + len >= highWaterMark_ && oldlen < highWaterMark_ && highWaterMarkCallback_)
+        {
+            loop_->queueInLoop(
+                std::bind(highWaterMarkCallback_,shared_from_this(),oldlen + len)
+            );
+        }
+        appendOutput(static_cast<const char*>(data),len);
+        if(!corkScheduled_)
+        {
+            corkScheduled_ = true;
+            loop_->queueAfterDispatch(std::bind(&TcpConnection::flushCorked,shared_from_this()),flushDeadlineUs_);
+        }
+        return;
+    }
+
+    // ET模式下EPOLLOUT一直是注册的，只需要看缓冲区中有没有待发送的数据
+    if((edgeTriggered_ || !channel_->isWriting()) && !hasPendingOutput())
     {// 表示channel_第一次开始写数据（没有注册epollout事件，因为默认都是注册的epollin事件），而且缓冲区没有待发送数据
         // 这个时候直接发送数据就可以了
         nwrote = ::write(channel_->fd(),data,len);
         if(nwrote >= 0)
         {
+            addTransferred(nwrote);
             remaining = len - nwrote;
             if(remaining == 0 && writeCompleteCallback_)
             {
@@ -120,34 +234,353 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
                 }
             }
         }
+    }
 
-        // 并没有发生错误,是数据没有发送完，剩余的数据需要保存到缓冲区当中，然后给channel注册epollout事件，
-        // poller发现当前的tcp发送缓冲区有剩余空间，会通知相应的socket-channel，调用writeCallback_回调方法（TcpConnection::handleWrite方法)，
-        // 最终把发送缓冲区中的数据全部发送完成
-        if(!faultError && remaining > 0)
+    // 并没有发生错误,是数据没有发送完（或者缓冲区中本来就有待发送的数据），剩余的数据需要保存到缓冲区当中，然后给channel注册epollout事件，
+    // poller发现当前的tcp发送缓冲区有剩余空间，会通知相应的socket-channel，调用writeCallback_回调方法（TcpConnection::handleWrite方法)，
+    // 最终把发送缓冲区中的数据全部发送完成
+    if(!faultError && remaining > 0)
+    {
+        size_t oldlen = outputBytes();  // 之前遗留的未发送的数据大小
+        if(oldlen + remaining >= highWaterMark_ && oldlen < highWaterMark_
+         && highWaterMarkCallback_)
         {
-            ssize_t oldlen = outputBuffer_.readableBytes();  // 之前遗留的未发送的数据大小
-            if(oldlen + remaining >= highWaterMark_ && oldlen < highWaterMark_
-             && highWaterMarkCallback_)
+        // 之前遗留的未发送的数据大小比水位线小，加上这次未发送的比水位线高，回调给用户高水位回调函数
+        loop_->queueInLoop(
+            std::bind(highWaterMarkCallback_,shared_from_this(),oldlen + remaining)
+        );
+        }
+
+        // 开始往outputBuffer中追加数据
+        appendOutput((char*)data + nwrote,remaining);
+       if(!channel_->isWriting())
+       {
+            channel_->enableWriting(); // 这里一定要注册channel的写事件，否则poller不会给channel通知epollout
+            // 真正发送剩余数据是在TcpConnection::handleWrite()中，这里不发送
+       }
+    }
+}
+void TcpConnection::send(const SharedPayload& payload)
+{
+    if(state_ == kConnected)
+    {
+        if(loop_->isInLoopThread())
+        {
+            sendPayloadInLoop(payload);
+        }
+        else
+        {
+            loop_->runInLoop(std::bind(
+                &TcpConnection::sendPayloadInLoop,
+                shared_from_this(),
+                payload)
+            );
+        }
+    }
+}
+
+void TcpConnection::sendPayloadInLoop(const SharedPayload& payload)
+{
+    if(zeroCopyThreshold_ == 0 || payload->size() < zeroCopyThreshold_)
+    {
+        sendInLoop(payload->data(), payload->size());
+        return;
+    }
+    if(state_ == kDisconnected)
+    {
+        LOG_ERROR("disconnected, give up writing!");
+        return;
+    }
+
+    PendingChunk chunk = { -1, payload, 0, payload->size(), Buffer(Buffer::kInitialSize, loop_->bufferPool()) };
+    const bool idle = !hasPendingOutput();
+    pendingChunks_.push_back(std::move(chunk));
+    if((edgeTriggered_ || !channel_->isWriting()) && idle)
+    {
+        // 前面没有排队的数据，直接发送一次，剩下的等EPOLLOUT
+        int savedErrno = 0;
+        ssize_t n = writeOnce(&savedErrno);
+        if(n < 0 && savedErrno != EWOULDBLOCK)
+        {
+            LOG_ERROR("TcpConnection::sendPayloadInLoop");
+        }
+        if(!hasPendingOutput())
+        {
+            if(writeCompleteCallback_)
             {
-            // 之前遗留的未发送的数据大小比水位线小，加上这次未发送的比水位线高，回调给用户高水位回调函数
-            loop_->queueInLoop(
-                std::bind(highWaterMarkCallback_,shared_from_this(),oldlen + remaining)
+                loop_->queueInLoop(std::bind(writeCompleteCallback_,shared_from_this()));
+            }
+            return;
+        }
+    }
+    if(!channel_->isWriting())
+    {
+        channel_->enableWriting();
+    }
+}
+
+void TcpConnection::flushCorked()
+{
+    corkScheduled_ = false;
+    if(state_ == kDisconnected || !hasPendingOutput())
+    {
+        return;
+    }
+    if(!edgeTriggered_ && channel_->isWriting())
+    {
+        return;  // 已经在等EPOLLOUT了，由handleWrite发送
+    }
+
+    // 一直写到EAGAIN或者写完，ChainBuffer时是一次writev
+    int savedErrno = 0;
+    ssize_t n = 0;
+    do
+    {
+        n = writeOnce(&savedErrno);
+    } while(n > 0 && hasPendingOutput());
+
+    if(!hasPendingOutput())
+    {
+        if(writeCompleteCallback_)
+        {
+            loop_->queueInLoop(std::bind(writeCompleteCallback_,shared_from_this()));
+        }
+        if(state_ == kDisconnecting)
+        {
+            shutdownInLoop();
+        }
+        else if(relaySink_)
+        {
+            relaySink_->onSinkWritable();
+        }
+    }
+    else
+    {
+        if(n < 0 && savedErrno != EAGAIN && savedErrno != EWOULDBLOCK)
+        {
+            LOG_ERROR("TcpConnection::flushCorked");
+        }
+        if(!channel_->isWriting())
+        {
+            channel_->enableWriting();
+        }
+    }
+}
+
+void TcpConnection::setZeroCopyThreshold(size_t thresholdBytes)
+{
+    if(thresholdBytes > 0 && zeroCopyThreshold_ == 0 && !socket_->setZeroCopy(true))
+    {
+        return;  // 内核不支持，继续使用拷贝发送
+    }
+    zeroCopyThreshold_ = thresholdBytes;
+}
+
+void TcpConnection::sendFile(int fd, off_t offset, size_t length)
+{
+    if(state_ == kConnected)
+    {
+        int fileFd = ::dup(fd);
+        if(fileFd < 0)
+        {
+            LOG_ERROR("TcpConnection::sendFile dup fd=%d failed, errno=%d \n", fd, errno);
+            return;
+        }
+        if(loop_->isInLoopThread())
+        {
+            sendFileInLoop(fileFd, offset, length);
+        }
+        else
+        {
+            loop_->runInLoop(std::bind(
+                &TcpConnection::sendFileInLoop,
+                shared_from_this(),
+                fileFd,
+                offset,
+                length)
             );
+        }
+    }
+}
+
+void TcpConnection::sendFileInLoop(int fd, off_t offset, size_t length)
+{
+    if(state_ == kDisconnected)
+    {
+        LOG_ERROR("disconnected, give up sending file!");
+        ::close(fd);
+        return;
+    }
+
+    size_t remaining = length;
+    if((edgeTriggered_ || !channel_->isWriting()) && !hasPendingOutput() && remaining > 0)
+    {
+        // 前面没有排队的数据，直接sendfile，剩下的等EPOLLOUT
+        ssize_t n = ::sendfile(channel_->fd(), fd, &offset, remaining);
+        if(n > 0)
+        {
+            addTransferred(n);
+            remaining -= n;
+        }
+        else if(n == 0)
+        {
+            LOG_ERROR("TcpConnection::sendFileInLoop file is shorter than %zu bytes \n", length);
+            remaining = 0;
+        }
+        else if(errno != EWOULDBLOCK)
+        {
+            LOG_ERROR("TcpConnection::sendFileInLoop");
+            if(errno == EPIPE || errno == ECONNRESET)
+            {
+                ::close(fd);
+                return;
             }
+        }
+    }
+
+    if(remaining == 0 && !hasPendingOutput())
+    {
+        ::close(fd);
+        if(writeCompleteCallback_)
+        {
+            loop_->queueInLoop(std::bind(writeCompleteCallback_,shared_from_this()));
+        }
+        return;
+    }
+
+    PendingChunk chunk = { fd, SharedPayload(), offset, remaining, Buffer(Buffer::kInitialSize, loop_->bufferPool()) };
+    pendingChunks_.push_back(std::move(chunk));
+    if(!channel_->isWriting())
+    {
+        channel_->enableWriting();
+    }
+}
+
+ssize_t TcpConnection::writeOnce(int* savedErrno)
+{
+    if(outputBytes() > 0)
+    {
+        ssize_t n = writeOutput(savedErrno);
+        if(n > 0)
+        {
+            addTransferred(n);
+        }
+        return n;
+    }
 
-            // 开始往outputBuffer中追加数据
-            outputBuffer_.append((char*)data + nwrote,remaining);
-           if(!channel_->isWriting())
-           {
-                channel_->enableWriting(); // 这里一定要注册channel的写事件，否则poller不会给channel通知epollout
-                // 真正发送剩余数据是在TcpConnection::handleWrite()中，这里不发送
-           }
+    PendingChunk& chunk = pendingChunks_.front();
+    ssize_t n = 0;
+    if(chunk.payload)
+    {
+        const char* data = chunk.payload->data() + chunk.offset;
+        n = ::send(channel_->fd(), data, chunk.remaining, MSG_ZEROCOPY);
+        if(n > 0)
+        {
+            zeroCopy_.sent(chunk.payload);  // 内核通知完成之前一直持有payload
+        }
+        else if(n < 0 && errno == ENOBUFS)
+        {
+            // 超过了锁页内存的限制（optmem_max），这一次退回到普通的拷贝发送
+            n = ::send(channel_->fd(), data, chunk.remaining, 0);
         }
     }
+    else if(chunk.remaining > 0)
+    {
+        n = ::sendfile(channel_->fd(), chunk.fd, &chunk.offset, chunk.remaining);
+        if(n == 0)
+        {
+            // 文件被截断了，剩下的部分放弃，接着发送后面的数据
+            LOG_ERROR("TcpConnection::handleWrite file is shorter than expected, %zu bytes left \n", chunk.remaining);
+            chunk.remaining = 0;
+        }
+    }
+    if(n < 0)
+    {
+        *savedErrno = errno;
+        return n;
+    }
+    addTransferred(n);
+
+    if(chunk.payload)
+    {
+        chunk.offset += n;  // sendfile自己推进了offset
+    }
+    chunk.remaining -= std::min(chunk.remaining, static_cast<size_t>(n));
+    if(chunk.remaining == 0)
+    {
+        finishPendingChunk();
+        if(n == 0)
+        {
+            return hasPendingOutput() ? writeOnce(savedErrno) : 0;
+        }
+    }
+    return n;
+}
+
+void TcpConnection::addTransferred(size_t n)
+{
+    loop_->load().addBytes(n);
+    if(idleWheel_)
+    {
+        idleWheel_->touch(&idleEntry_);
+    }
+}
 
+void TcpConnection::finishPendingChunk()
+{
+    PendingChunk& chunk = pendingChunks_.front();
+    if(chunk.fd >= 0)
+    {
+        ::close(chunk.fd);
+    }
+    // 这时发送缓冲区一定是空的
+    if(chainedOutput_)
+    {
+        chainOutput_.append(chunk.trailer.peek(), chunk.trailer.readableBytes());
+    }
+    else
+    {
+        outputBuffer_.swap(chunk.trailer);
+    }
+    pendingChunks_.pop_front();
+}
 
+void TcpConnection::appendOutput(const char* data, size_t len)
+{
+    if(!pendingChunks_.empty())
+    {
+        // 有文件或者payload在排队，数据要排在最后一块的后面
+        pendingChunks_.back().trailer.append(data, len);
+    }
+    else if(chainedOutput_)
+    {
+        chainOutput_.append(data, len);
+    }
+    else
+    {
+        outputBuffer_.append(data, len);
+    }
 }
+
+ssize_t TcpConnection::writeOutput(int* savedErrno)
+{
+    ssize_t n = chainedOutput_ ? chainOutput_.writeFd(channel_->fd(), savedErrno)
+                               : outputBuffer_.writeFd(channel_->fd(), savedErrno);
+    if(n > 0)
+    {
+        if(chainedOutput_)
+        {
+            chainOutput_.retrieve(n);
+        }
+        else
+        {
+            outputBuffer_.retrieve(n);
+            outputBuffer_.shrinkIfIdle();   // 发送完了，突发撑大的缓冲区还给pool
+        }
+    }
+    return n;
+}
+
 // 关闭连接
 void TcpConnection::shutdown()
 {
@@ -162,9 +595,14 @@ void TcpConnection::shutdown()
 
 void TcpConnection::shutdownInLoop()
 {
-    if (!channel_->isWriting()) // 说明outputBuffer中的数据已经全部发送完成
+    if (!hasPendingOutput()) // 说明outputBuffer中的数据和文件已经全部发送完成
     {
         socket_->shutdownWrite(); // 关闭写端，会在channle中触发EPOLLHUP（默认都会注册），会回调closeCallback（最终执行到hanleClose）
+        // 作为relay源端已经读到EOF时读事件已经关掉了，收不到EPOLLHUP，两个方向都结束了直接关闭
+        if(relaySource_ && relaySource_->sourceEof() && state_ != kDisconnected)
+        {
+            handleClose();
+        }
     }
     // 数据如果没发送完，会在handleWrite发送完后执行此函数
 }
@@ -174,7 +612,21 @@ void TcpConnection::connectEstablished()
 {
     setState(kConnected);
     channel_->tie(shared_from_this());
+    if(loop_->busyPollUs() > 0)
+    {
+        socket_->setBusyPoll(loop_->busyPollUs());
+    }
+    if(edgeTriggered_)
+    {
+        channel_->enableEdgeTriggered(true); // EPOLLET|EPOLLOUT和下面的读事件一起，只调用一次epoll_ctl
+    }
     channel_->enableReading(); // 默认只注册读事件 向poller注册channel的epollin事件
+    if(idleTimeoutSec_ > 0)
+    {
+        // 条目在handleClose或者connectDestroyed中移除，回调时连接一定还在
+        idleWheel_ = loop_->timingWheel();
+        idleWheel_->add(&idleEntry_, idleTimeoutSec_, std::bind(&TcpConnection::handleIdleTimeout, this));
+    }
 
     // 新连接建立，执行回调
     connectionCallback_(shared_from_this());
@@ -183,6 +635,11 @@ void TcpConnection::connectEstablished()
 // 连接销毁
 void TcpConnection::connectDestroyed()
 {
+    loop_->load().connectionRemoved();
+    if(idleWheel_)
+    {
+        idleWheel_->remove(&idleEntry_);
+    }
     if (state_ == kConnected)
     {
         setState(kDisconnected);
@@ -192,12 +649,60 @@ void TcpConnection::connectDestroyed()
     channel_->remove(); // 把channel从poller中删除掉
 }
 
+bool TcpConnection::handOff(int* sockfd, std::string* input)
+{
+    if(state_ != kConnected || hasPendingOutput() || corkScheduled_ || zeroCopy_.pending() > 0
+        || relaySource_ || relaySink_ || inputBuffer_.readableBytes() > Upgrade::kMaxInput)
+    {
+        return false;
+    }
+    int fd = ::fcntl(channel_->fd(), F_DUPFD_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        LOG_ERROR("TcpConnection::handOff [%s] dup error:%d \n", name_.c_str(), errno);
+        return false;
+    }
+    *sockfd = fd;
+    *input = inputBuffer_.retrieveAllAsString();
+    LOG_INFO("TcpConnection::handOff [%s] with %zu bytes of input \n", name_.c_str(), input->size());
+    handedOff_ = true;
+    handleClose();
+    return true;
+}
+
+void TcpConnection::connectInherited(const std::string& input)
+{
+    connectEstablished();
+    if(!input.empty() && state_ == kConnected)
+    {
+        inputBuffer_.append(input.data(), input.size());
+        messageCallback_(shared_from_this(), &inputBuffer_, TimeStamp::now());
+    }
+}
+
 void TcpConnection::handleRead(TimeStamp receiveTime)
 {
+    if(idleWheel_)
+    {
+        idleWheel_->touch(&idleEntry_);
+    }
+    if(relaySource_)
+    {
+        // 数据由SpliceRelay直接splice到另一个连接，不经过inputBuffer_
+        relaySource_->onSourceReadable();
+        return;
+    }
+    if(edgeTriggered_)
+    {
+        handleReadEdgeTriggered(receiveTime);
+        return;
+    }
+
     int savedErrno = 0;
     ssize_t n = inputBuffer_.readFd(channel_->fd(),&savedErrno);
     if(n >0)
     {
+        addTransferred(n);
         // 已建立连接的用户，有可读事件发生了，调用用户传入的回调操作onMessage，也就是给用户通知读数据
         messageCallback_(shared_from_this(),&inputBuffer_,receiveTime);
     }
@@ -214,30 +719,126 @@ void TcpConnection::handleRead(TimeStamp receiveTime)
     }
 }
 
+// ET模式：一直读到EAGAIN或者对端关闭，读到的数据一次性交给用户
+// 读够limit字节就停下，对端发得很快时不能一直占着loop，剩下的排到本轮其他channel之后再读
+void TcpConnection::handleReadEdgeTriggered(TimeStamp receiveTime)
+{
+    ssize_t limit = static_cast<ssize_t>(inputBuffer_.maxReadBytes());
+    if(limit == 0)
+    {
+        limit = kMaxEdgeTriggeredReadBytes;
+    }
+    ssize_t total = 0;
+    bool peerClosed = false;
+    bool more = false;
+    int savedErrno = 0;
+    while(true)
+    {
+        if(total >= limit)
+        {
+            more = true;
+            break;
+        }
+        ssize_t n = inputBuffer_.readFd(channel_->fd(),&savedErrno);
+        if(n > 0)
+        {
+            total += n;
+        }
+        else if(n == 0)
+        {
+            peerClosed = true;
+            break;
+        }
+        else if(savedErrno == EINTR)
+        {
+            continue;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if(total > 0)
+    {
+        addTransferred(total);
+        messageCallback_(shared_from_this(),&inputBuffer_,receiveTime);
+    }
+
+    if(peerClosed)
+    {
+        handleClose();
+    }
+    else if(more)
+    {
+        // socket中可能还有数据，ET模式下不会再通知
+        loop_->queueInLoop(std::bind(&TcpConnection::continueEdgeTriggeredRead, shared_from_this()));
+    }
+    else if(savedErrno != EAGAIN && savedErrno != EWOULDBLOCK)
+    {
+        errno = savedErrno;
+        LOG_ERROR("TcpConnection::handleRead");
+        handleError();
+    }
+}
+
+void TcpConnection::continueEdgeTriggeredRead()
+{
+    // messageCallback中可能已经关闭了连接，或者把连接交给了SpliceRelay，由relay自己读
+    if(state_ == kDisconnected || relaySource_)
+    {
+        return;
+    }
+    handleReadEdgeTriggered(TimeStamp::now());
+}
+
 void TcpConnection::handleWrite()
 {
+    if(idleWheel_)
+    {
+        idleWheel_->touch(&idleEntry_);
+    }
+    if(relaySink_ && !hasPendingOutput())
+    {
+        relaySink_->onSinkWritable();
+        return;
+    }
+    if(edgeTriggered_ && !hasPendingOutput())
+    {
+        // ET模式下EPOLLOUT一直是注册的，没有待发送的数据直接返回
+        return;
+    }
+
     if(channel_->isWriting())  // 判断是否可写，也就是是否注册了写事件
     {
         int savedErrno = 0;
-        ssize_t n = outputBuffer_.writeFd(channel_->fd(),&savedErrno);  // 这里面已经写到fd中了
-        if(n > 0)
+        // 这里面已经写到fd中了，并且清理了已经发送的n个数据
+        ssize_t n = writeOnce(&savedErrno);
+        // ET模式下一直写到EAGAIN或者写完为止，否则不会再收到EPOLLOUT
+        while(edgeTriggered_ && n > 0 && hasPendingOutput())
         {
-            // 已经发送到网络中了n个数据了，需要清理一下已经发送的n个数据
-            outputBuffer_.retrieve(n);
-            if(outputBuffer_.readableBytes() == 0)
-            {// 已经发送完成了
+            n = writeOnce(&savedErrno);
+        }
+        if(!hasPendingOutput())
+        {// 已经发送完成了
+            if(!edgeTriggered_)
+            {
                 channel_->disableWriting();
-                if(writeCompleteCallback_)
-                {
-                    loop_->queueInLoop(std::bind(writeCompleteCallback_,shared_from_this()));
-                }
-                if(state_ == kDisconnecting)
-                {
-                    shutdownInLoop();
-                }
+            }
+            if(writeCompleteCallback_)
+            {
+                loop_->queueInLoop(std::bind(writeCompleteCallback_,shared_from_this()));
+            }
+            if(state_ == kDisconnecting)
+            {
+                shutdownInLoop();
+            }
+            else if(relaySink_)
+            {
+                relaySink_->onSinkWritable();
             }
         }
-        else
+        else if(n < 0 && (!edgeTriggered_ || (savedErrno != EAGAIN && savedErrno != EWOULDBLOCK)))
         {
             LOG_ERROR("TcpConnection::handleWrite");
         }
@@ -249,17 +850,72 @@ void TcpConnection::handleWrite()
 }
 
 // Poller->Channel->TcpConnection::hanleClose->TcpServer::removeConnection->TcpConnection::connectDestroyed
+void TcpConnection::handleIdleTimeout()
+{
+    LOG_INFO("TcpConnection::handleIdleTimeout [%s] idle for %d seconds \n", name_.c_str(), idleTimeoutSec_);
+    handleClose();
+}
+
 void TcpConnection::handleClose()
 {
     LOG_INFO("TcpConnection::handleClose fd=%d state=%d \n", channel_->fd(), (int)state_);
+    if(state_ == kDisconnected)
+    {
+        // SpliceRelay出错时已经关闭了连接，同一轮poll返回的EPOLLHUP/EPOLLERR不能再关闭一次
+        return;
+    }
     setState(kDisconnected);
     channel_->disableAll();
+    if(idleWheel_)
+    {
+        idleWheel_->remove(&idleEntry_);
+    }
 
     TcpConnectionPtr connPtr(shared_from_this());
+    if(relaySource_)
+    {
+        relaySource_->onSourceClosed();
+    }
+    if(relaySink_)
+    {
+        relaySink_->onSinkClosed();
+    }
     connectionCallback_(connPtr);  // 执行连接关闭的回调
     closeCallback_(connPtr); // 关闭连接的回调  执行的是TcpServer::removeConnection回调方法
 }
 
+void TcpConnection::handleCloseEvent()
+{
+    // SpliceRelay暂停读的时候收到EPOLLHUP，socket中的数据还没有转发完，由relay读到EOF以后关闭
+    if(relaySource_ && relaySource_->deferSourceClose())
+    {
+        return;
+    }
+    handleClose();
+}
+
+void TcpConnection::handleErrorEvent()
+{
+    // 开启零拷贝以后，完成通知放在错误队列中，也会触发EPOLLERR，读完通知以后socket没有错误就不是真正的出错
+    if(zeroCopyThreshold_ > 0 && zeroCopy_.drainErrorQueue(channel_->fd()) > 0)
+    {
+        int optval = 0;
+        socklen_t optlen = sizeof optval;
+        if(::getsockopt(channel_->fd(), SOL_SOCKET, SO_ERROR, &optval, &optlen) < 0)
+        {
+            optval = errno;
+        }
+        // SO_ERROR读一次就被清除了，不能再交给handleError读
+        if(optval != 0)
+        {
+            LOG_ERROR("TcpConnection::handleError name:%s - SO_ERROR:%d \n", name_.c_str(), optval);
+        }
+        return;
+    }
+    // 和原来一样只记录错误，连接由同时返回的EPOLLHUP或者随后读写失败关闭
+    handleError();
+}
+
 void TcpConnection::handleError()
 {
     int optval;
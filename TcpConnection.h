@@ -4,15 +4,21 @@
 #include "InetAddress.h"
 #include "Callbacks.h"
 #include "Buffer.h"
+#include "ChainBuffer.h"
+#include "ZeroCopyTracker.h"
 #include "TimeStamp.h"
+#include "TimingWheel.h"
 
 #include <memory>
 #include <string>
 #include <atomic>
+#include <deque>
+#include <sys/types.h>
 
 class Channel;
 class EventLoop;
 class Socket;
+class SpliceRelay;
 
 /*
 * TcpServer => Acceptor(负责监听新连接)=>有一个用户连接，通过accept函数拿到connfd => 创建TcpConnection并设置回调
@@ -25,20 +31,68 @@ public:
                 const std::string& name,
                 int sockfd,
                 const InetAddress& localAddr,
-                const InetAddress& peerAddr);
+                const InetAddress& peerAddr,
+                uint64_t id = 0);
     
     ~TcpConnection();
 
     // 返回当前connection所在的事件循环loop
     EventLoop* getLoop() const {return loop_;}
     const std::string& name() const { return name_; }
+    // TcpServer分配的连接id，可以用TcpServer::getConnection查找
+    uint64_t id() const { return id_; }
     const InetAddress& localAddress() const { return localAddr_; }
     const InetAddress& peerAddress() const { return peerAddr_; }
 
     bool connected() const {return state_ == kConnected;}
 
-   // 发送数据
-    void send(const std::string &buf);
+    // 使用ET模式，需要在connectEstablished之前设置
+    // EPOLLOUT在连接的整个生命周期保持注册，写一直进行到EAGAIN为止
+    // 一次事件读够kMaxEdgeTriggeredReadBytes（inputBuffer设置了maxReadBytes时用它）就停下，剩下的放到本轮其他channel之后继续读
+    static const size_t kMaxEdgeTriggeredReadBytes = 1024 * 1024;
+    void setEdgeTriggered(bool on) { edgeTriggered_ = on; }
+    bool edgeTriggered() const { return edgeTriggered_; }
+
+    // 发送缓冲区使用分块的ChainBuffer，积压数据很多时追加不需要扩容拷贝，发送时用writev聚合写
+    // 需要在connectEstablished之前设置
+    void setChainedOutput(bool on) { chainedOutput_ = on; }
+    bool chainedOutput() const { return chainedOutput_; }
+
+    // 超过seconds秒没有读写事件就关闭连接，0表示不检查，需要在connectEstablished之前设置
+    // 使用所在loop的时间轮，精度1秒，读写时只记录一次活跃时间
+    void setIdleTimeout(int seconds) { idleTimeoutSec_ = seconds; }
+    int idleTimeout() const { return idleTimeoutSec_; }
+
+    // 限制一次从socket读取的最大字节数，0表示不限制，需要在loop线程中调用（比如ConnectionCallback中）
+    void setMaxReadBytes(size_t maxBytes) { inputBuffer_.setMaxReadBytes(maxBytes); }
+
+   // 发送数据，都可以在任意线程调用，在其他线程调用时数据只转移一次到loop线程
+    void send(const std::string &buf);      // 拷贝一次
+    void send(std::string &&buf);           // 移动，不拷贝
+    void send(const void* data, size_t len); // 拷贝一次
+    // 发送buf中所有可读的数据并取走，在其他线程调用时整个Buffer的存储移动到loop线程，不拷贝
+    void send(Buffer* buf);
+    // 自动合并写（auto-cork）：loop线程中的send只追加到发送缓冲区，本轮事件处理完以后每个连接只发送一次
+    // 一次onMessage中多次send的小消息合并成一次系统调用和尽量少的TCP分段
+    // flushDeadlineUs > 0时，如果本轮处理事件的时间超过了这个值，不等本轮结束提前发送，用于对延迟敏感的连接
+    // 需要在loop线程中调用（比如ConnectionCallback中）
+    void setAutoCork(bool on, int flushDeadlineUs = 0) { autoCork_ = on; flushDeadlineUs_ = flushDeadlineUs; }
+    bool autoCork() const { return autoCork_; }
+
+    // 共享的只读payload，连接持有引用直到发送（零拷贝发送时是内核通知完成）以后
+    using SharedPayload = ZeroCopyTracker::Payload;
+    // 不拷贝payload，只转移一份引用到loop线程；达到零拷贝阈值时使用MSG_ZEROCOPY发送
+    void send(const SharedPayload& payload);
+
+    // 不小于thresholdBytes的SharedPayload使用MSG_ZEROCOPY发送，0表示关闭，需要在loop线程中调用（比如ConnectionCallback中）
+    // 小消息零拷贝得不偿失（需要锁页和处理完成通知），一般用在几百K以上的大块数据
+    void setZeroCopyThreshold(size_t thresholdBytes);
+    size_t zeroCopyThreshold() const { return zeroCopyThreshold_; }
+    const ZeroCopyTracker& zeroCopyTracker() const { return zeroCopy_; }
+
+    // 用sendfile发送文件fd中[offset, offset+length)的内容，和send的数据按调用的顺序发送
+    // 内部会dup一份fd，调用者返回以后就可以关闭自己的fd，所有数据发送完以后回调writeCompleteCallback
+    void sendFile(int fd, off_t offset, size_t length);
     // 关闭连接
     void shutdown();
    void setConnectionCallback(const ConnectionCallback& cb)
@@ -62,25 +116,73 @@ public:
     // 连接销毁
     void connectDestroyed();
 
+    // 平滑升级，都只能在loop线程调用
+    // 连接空闲（没有待发送的数据，也没有被SpliceRelay使用）时dup一份fd、取出inputBuffer中没有处理的数据，
+    // 然后在本进程中关闭连接（不shutdown，socket由dup出来的fd保持），否则返回false
+    // 关闭时和普通断开一样回调connectionCallback，回调中用handedOff()区分
+    bool handOff(int* sockfd, std::string* input);
+    // 连接是否是交给新进程而断开的，对端并没有断开
+    bool handedOff() const { return handedOff_; }
+    // 从旧进程继承的连接建立，input是旧进程中还没有处理的数据，不为空时马上回调messageCallback
+    void connectInherited(const std::string& input);
+
     // 回调函数，给channel设置，channel最终通过EventLoop调用回调函数回调过来
     void handleRead(TimeStamp receiveTime);
+    void handleReadEdgeTriggered(TimeStamp receiveTime);
+    void continueEdgeTriggeredRead();   // ET模式读到上限以后继续读
     void handleWrite();
     void handleClose();
+    void handleCloseEvent();    // EPOLLHUP，relay源端还有没转发的数据时推迟关闭
     void handleError();
+    void handleErrorEvent();    // EPOLLERR，可能只是零拷贝的完成通知
+    void handleIdleTimeout();   // 时间轮回调，空闲超时
 
     void sendInLoop(const void* message, size_t len);
+    void sendStringInLoop(const std::string& message);
+    void sendBufferInLoop(Buffer& buf);
+    void sendFileInLoop(int fd, off_t offset, size_t length);
+    void sendPayloadInLoop(const SharedPayload& payload);
+    void flushCorked();     // 发送auto-cork积攒的数据
     void shutdownInLoop();
 
 
 private:
+    friend class SpliceRelay;
 
     enum StateE {kDisconnected, kConnecting, kConnected, kDisconnecting};
     void setState(StateE state) { state_ = state; }
 
+    // 发送缓冲区的操作，根据chainedOutput_选择outputBuffer_或者chainOutput_
+    size_t outputBytes() const
+    { return chainedOutput_ ? chainOutput_.readableBytes() : outputBuffer_.readableBytes(); }
+    void appendOutput(const char* data, size_t len);
+    ssize_t writeOutput(int* savedErrno);  // 发送并清理已经发送出去的数据
+
+    // 排在发送缓冲区后面等待发送的文件（sendfile）或者零拷贝payload
+    // trailer中是排队期间send的数据，要在这一块之后发送
+    struct PendingChunk
+    {
+        int fd;                 // 文件，payload时为-1
+        SharedPayload payload;  // 零拷贝发送的数据
+        off_t offset;
+        size_t remaining;
+        Buffer trailer;
+    };
+    bool hasPendingOutput() const { return outputBytes() > 0 || !pendingChunks_.empty(); }
+    // 按顺序发送一次：先发送缓冲区中的数据，缓冲区空了再发送队首的文件或者payload
+    ssize_t writeOnce(int* savedErrno);
+    // 队首的一块发送完了，关闭文件，它后面的数据接到发送缓冲区中
+    void finishPendingChunk();
+    // 收发了n字节：计入loop的负载，同时算作连接的活跃，直接写出去的数据不经过handleWrite，也要刷新空闲超时
+    void addTransferred(size_t n);
+
     EventLoop* loop_; // 这里不是baseLoop，因为TcpConnnection都是再subloop中管理的
     const std::string name_;
+    const uint64_t id_;
     std::atomic_int state_;
     bool reading_;
+    bool edgeTriggered_;
+    bool chainedOutput_;
 
     std::unique_ptr<Socket> socket_;
     std::unique_ptr<Channel> channel_;
@@ -97,4 +199,17 @@ private:
 
     Buffer inputBuffer_;  // 接收数据的缓冲区,从这里读取数据（进数据）
     Buffer outputBuffer_; // 发送数据的缓冲区,把数据写到这里先，最终要发送出去（出数据）
+    ChainBuffer chainOutput_; // chainedOutput_模式下的发送缓冲区
+    std::deque<PendingChunk> pendingChunks_;  // 排在发送缓冲区后面等待发送的文件和零拷贝payload
+    size_t zeroCopyThreshold_;
+    bool autoCork_;
+    bool corkScheduled_;    // 本轮已经登记过flushCorked
+    int flushDeadlineUs_;
+    ZeroCopyTracker zeroCopy_;
+    std::shared_ptr<SpliceRelay> relaySource_;  // 作为SpliceRelay的源端，读事件交给relay
+    std::shared_ptr<SpliceRelay> relaySink_;    // 作为SpliceRelay的目的端，可写时通知relay
+    int idleTimeoutSec_;
+    TimingWheel* idleWheel_;        // 设置了空闲超时时是所在loop的时间轮
+    TimingWheel::Entry idleEntry_;
+    bool handedOff_;
 };
\ No newline at end of file
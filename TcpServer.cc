@@ -1,9 +1,14 @@
 #include "TcpServer.h"
 #include "Logger.h"
 #include "TcpConnection.h"
+#include "LoopMetrics.h"
 
 #include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include <functional>
+#include <condition_variable>
 
 static EventLoop* CheackLoopNotNull(EventLoop* loop)
 {
@@ -18,34 +23,118 @@ TcpServer::TcpServer(EventLoop* loop,
         const InetAddress &listenAddr,
         const std::string &nameArg,
         Option option)
+        : TcpServer(loop, listenAddr, nameArg, option,
+            new Acceptor(CheackLoopNotNull(loop),listenAddr,option != kNoReusePort))
+{
+}
+
+// 继承的监听socket绑定的地址
+static InetAddress listenAddressOf(const Upgrade::Sockets &inherited)
+{
+    sockaddr_in local;
+    ::bzero(&local,sizeof local);
+    socklen_t addrlen = sizeof local;
+    if(inherited.listenFds.empty()
+        || ::getsockname(inherited.listenFds[0],(sockaddr*)&local,&addrlen) < 0)
+    {
+        LOG_FATAL("%s:%s:%d no inherited listening socket \n", __FILE__, __FUNCTION__, __LINE__);
+    }
+    return InetAddress(local);
+}
+
+TcpServer::TcpServer(EventLoop* loop,
+        const Upgrade::Sockets &inherited,
+        const std::string &nameArg,
+        Option option)
+        : TcpServer(loop, listenAddressOf(inherited), nameArg, option,
+            new Acceptor(CheackLoopNotNull(loop),inherited.listenFds.empty() ? -1 : inherited.listenFds[0]))
+{
+    inheritedListenFds_.assign(inherited.listenFds.begin() + 1, inherited.listenFds.end());
+    inheritedConnections_ = inherited.connections;
+}
+
+TcpServer::TcpServer(EventLoop* loop,
+        const InetAddress &listenAddr,
+        const std::string &nameArg,
+        Option option,
+        Acceptor* acceptor)
         : loop_(CheackLoopNotNull(loop))
         , name_(nameArg)
         , ipPort_(listenAddr.toIpPort())
-        , acceptor_(new Acceptor(loop,listenAddr,option == kReusePort))
+        , connNamePrefix_(nameArg + "-" + ipPort_ + "#")
+        , listenAddr_(listenAddr)
+        , option_(option)
+        , acceptor_(acceptor)
         , threadPool_(new EventLoopThreadPool(loop,name_))
         , connectionCallback_()
         , messageCallback_()
-        , nextConnId_(1)
+        , edgeTriggered_(false)
+        , chainedOutput_(false)
+        , autoCork_(false)
+        , flushDeadlineUs_(0)
+        , idleTimeoutSec_(0)
+        , maxConnections_(0)
+        , maxConnectionsPerLoop_(0)
+        , acceptPause_(false)
+        , maxPendingFunctors_(0)
+        , maxUtilization_(0.0)
+        , numConnections_(0)
         , started_(0)
+        , upgradeFd_(-1)
+        , handOffIdle_(false)
+        , handedOff_(false)
+        , drained_(false)
 {
+    for(int i = 0; i < kNumAdmissionCounters; ++i)
+    {
+        admissionCounts_[i].store(0, std::memory_order_relaxed);
+    }
     // 设置newConnecttion回调，当有新用户连接的时候，会执行这个回调
-    acceptor_->setNewConnectionCallback(std::bind(&TcpServer::newConnection,this
-                                        ,std::placeholders::_1
-                                        ,std::placeholders::_2));
+    acceptor_->setNewConnectionsCallback(std::bind(&TcpServer::newConnections,this
+                                        ,std::placeholders::_1));
+}
+
+static void destroyAcceptor(Acceptor* acceptor)
+{
+    delete acceptor;
 }
 
 TcpServer::~TcpServer()
 {
-    for(auto &item : connections_)
+    if(upgradeFd_ >= 0)
+    {
+        upgradeChannel_->disableAll();
+        upgradeChannel_->remove();
+        ::close(upgradeFd_);
+    }
+    // 没有来得及建立的继承连接
+    for(const Upgrade::Connection &inherited : inheritedConnections_)
+    {
+        ::close(inherited.sockfd);
+    }
+
+    // Acceptor要在自己的loop线程中从poller上移除
+    for(auto &acceptor : loopAcceptors_)
+    {
+        EventLoop* ioLoop = acceptor->getLoop();
+        ioLoop->runInLoop(std::bind(&destroyAcceptor, acceptor.release()));
+    }
+
+    for(auto &shard : shards_)
     {
-        // 这个局部的shared_ptr智能指针对象，出右括号，可以自动释放new出来的TcpConnection对象资源了
-        TcpConnectionPtr conn(item.second); 
-        item.second.reset();
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for(auto &item : shard->connections)
+        {
+            // 这个局部的shared_ptr智能指针对象，出右括号，可以自动释放new出来的TcpConnection对象资源了
+            TcpConnectionPtr conn(item.second); 
+            item.second.reset();
 
-        // 销毁连接
-        conn->getLoop()->runInLoop(
-            std::bind(&TcpConnection::connectDestroyed,conn)
-        );
+            // 销毁连接
+            EventLoop* ioLoop = conn->getLoop();
+            ioLoop->runInLoop(
+                std::bind(&TcpConnection::connectDestroyed,std::move(conn))
+            );
+        }
     }
 }
 
@@ -54,74 +143,496 @@ void TcpServer::start()
     if(started_++ == 0)
     {
         threadPool_->start(threadInitCallback_);
-        loop_->runInLoop(std::bind(&Acceptor::listen,acceptor_.get()));
+        std::vector<EventLoop*> loops = threadPool_->getAllLoops();
+        // 每个loop一个连接注册表，之后只读
+        for(size_t i = 0; i < loops.size(); ++i)
+        {
+            shards_.push_back(std::unique_ptr<ConnectionShard>(new ConnectionShard));
+            shardIndex_[loops[i]] = i;
+            if(maxPendingFunctors_ > 0)
+            {
+                loops[i]->setCountPendingFunctors(true);
+            }
+        }
+        if(option_ != kReusePortPerLoop || (loops.size() == 1 && loops[0] == loop_))
+        {
+            if(acceptPause_ && maxConnections_ > 0)
+            {
+                acceptor_->setAdmitCallback(std::bind(&TcpServer::canAccept,this
+                                            ,nullptr
+                                            ,std::placeholders::_1));
+            }
+            // 旧进程是kReusePortPerLoop时继承的其他监听socket里可能还有排队的连接，也在baseLoop上accept
+            for(int listenfd : inheritedListenFds_)
+            {
+                addLoopAcceptor(loop_, listenfd, false);
+            }
+            loop_->runInLoop(std::bind(&Acceptor::listen,acceptor_.get()));
+        }
+        else
+        {
+            // 每个subloop监听同一个地址，acceptor_只保留绑定，不参与accept
+            // 优先使用继承的监听socket，loop比继承的socket少时多出来的socket也分给各个loop
+            for(size_t i = 0; i < loops.size() || i < inheritedListenFds_.size(); ++i)
+            {
+                int listenfd = i < inheritedListenFds_.size() ? inheritedListenFds_[i] : -1;
+                addLoopAcceptor(loops[i % loops.size()], listenfd, true);
+            }
+        }
+        // 所有的Acceptor都放进loopAcceptors_以后再开始accept，否则已经在accept的loop上断开连接时
+        // resumeAccept会在这里push_back的同时遍历loopAcceptors_
+        for(auto &acceptor : loopAcceptors_)
+        {
+            acceptor->getLoop()->runInLoop(std::bind(&Acceptor::listen,acceptor.get()));
+        }
+        inheritedListenFds_.clear();
+        establishInherited();
     }
 }
 
+void TcpServer::addLoopAcceptor(EventLoop* ioloop, int listenfd, bool perLoop)
+{
+    std::unique_ptr<Acceptor> acceptor(listenfd >= 0 ? new Acceptor(ioloop, listenfd)
+                                                     : new Acceptor(ioloop, listenAddr_, true));
+    acceptor->setEdgeTriggered(edgeTriggered_);
+    if(perLoop)
+    {
+        acceptor->setNewConnectionCallback(std::bind(&TcpServer::newConnectionInLoop,this
+                                            ,ioloop
+                                            ,std::placeholders::_1
+                                            ,std::placeholders::_2));
+    }
+    else
+    {
+        acceptor->setNewConnectionsCallback(std::bind(&TcpServer::newConnections,this
+                                            ,std::placeholders::_1));
+    }
+    if(acceptPause_ && (maxConnections_ > 0 || (perLoop && maxConnectionsPerLoop_ > 0)))
+    {
+        acceptor->setAdmitCallback(std::bind(&TcpServer::canAccept,this
+                                    ,perLoop ? ioloop : nullptr
+                                    ,std::placeholders::_1));
+    }
+    loopAcceptors_.push_back(std::move(acceptor));
+}
+
 void TcpServer::setThreadNums(int threadNums)
 {
     threadPool_->setThreadNum(threadNums);
 }
 
-// 有一个新的客户端的连接，acceptor会执行这个回调操作 在TcpServer的构造函数中设置了这个回调函数
-void TcpServer::newConnection(int sockfd, const InetAddress &peerAddr)
+void TcpServer::setEdgeTriggered(bool on)
+{
+    edgeTriggered_ = on;
+    acceptor_->setEdgeTriggered(on);
+}
+
+// 有新的客户端连接，acceptor一次事件accept到的所有连接一起回调 在TcpServer的构造函数中设置了这个回调函数
+// 每个subLoop的连接攒成一批，一次runInLoop（一次唤醒）建立
+void TcpServer::newConnections(const std::vector<Acceptor::Accepted> &accepted)
+{
+    std::vector<std::pair<EventLoop*, std::vector<TcpConnectionPtr>>> batches;
+    for(const Acceptor::Accepted &item : accepted)
+    {
+        // 按线程池的策略（默认轮询）选择一个subLoop，来管理channel
+        EventLoop* ioloop = threadPool_->getNextLoop(item.peerAddr);
+        if(!admit(ioloop))
+        {
+            ::close(item.sockfd);
+            continue;
+        }
+        size_t i = 0;
+        while(i < batches.size() && batches[i].first != ioloop)
+        {
+            ++i;
+        }
+        if(i == batches.size())
+        {
+            batches.push_back(std::make_pair(ioloop, std::vector<TcpConnectionPtr>()));
+        }
+        batches[i].second.push_back(createConnection(ioloop, item.sockfd, item.peerAddr));
+    }
+
+    for(auto &batch : batches)
+    {
+        batch.first->runInLoop(std::bind(&TcpServer::establishConnections, std::move(batch.second)));
+    }
+}
+
+void TcpServer::establishConnections(const std::vector<TcpConnectionPtr> &conns)
+{
+    for(const TcpConnectionPtr &conn : conns)
+    {
+        conn->connectEstablished();
+    }
+}
+
+// 在ioloop上建立连接，kReusePortPerLoop模式下由ioloop自己的Acceptor直接调用
+void TcpServer::newConnectionInLoop(EventLoop* ioloop, int sockfd, const InetAddress &peerAddr)
 {
-    //  轮询算法，选择一个subLoop，来管理channel
-    EventLoop* ioloop = threadPool_->getNextLoop();
+    if(!admit(ioloop))
+    {
+        ::close(sockfd);
+        return;
+    }
+    // 直接调用TcpConnection::connectEstablished
+    ioloop->runInLoop(std::bind(&TcpConnection::connectEstablished,createConnection(ioloop, sockfd, peerAddr)));
+}
 
-    char buf[64] = {0};
-    snprintf(buf,sizeof buf,"-%s#%d",ipPort_.c_str(),nextConnId_);
-    ++nextConnId_;
-    std::string connName = name_ + buf;
+TcpConnectionPtr TcpServer::createConnection(EventLoop* ioloop, int sockfd, const InetAddress &peerAddr)
+{
+    // 连接id的高16位是所在loop的注册表下标，低48位是这个注册表内的序号，分配和查找都只涉及一个注册表
+    const size_t shardIdx = shardIndex_.find(ioloop)->second;
+    ConnectionShard& shard = *shards_[shardIdx];
+    const uint64_t seq = shard.nextSeq.fetch_add(1, std::memory_order_relaxed);
+    const uint64_t connId = (static_cast<uint64_t>(shardIdx) << kShardShift) | seq;
+    std::string connName = connNamePrefix_ + std::to_string(shardIdx) + "-" + std::to_string(seq);
 
     LOG_INFO("TcpServer::newConnection [%s] - new connection [%s] from %s \n",
         name_.c_str(), connName.c_str(), peerAddr.toIpPort().c_str());
 
-        // 通过sockfd获取其绑定的本机的ip地址和端口信息
-    sockaddr_in local;
-    ::bzero(&local,sizeof local);
-    socklen_t addrlen = sizeof local;
-    if(::getsockname(sockfd,(sockaddr*)&local,&addrlen) < 0)
+    // 监听的是具体的地址时本机地址就是监听地址，监听INADDR_ANY时才需要通过sockfd获取其绑定的本机的ip地址和端口信息
+    InetAddress localAddr(listenAddr_);
+    if(listenAddr_.getSockAddr()->sin_addr.s_addr == htonl(INADDR_ANY))
     {
-        LOG_ERROR("sockets::getLocalAddr");
+        sockaddr_in local;
+        ::bzero(&local,sizeof local);
+        socklen_t addrlen = sizeof local;
+        if(::getsockname(sockfd,(sockaddr*)&local,&addrlen) < 0)
+        {
+            LOG_ERROR("sockets::getLocalAddr");
+        }
+        localAddr.setSockAddr(local);
     }
-    InetAddress localAddr(local);
 
     // 根据连接成功的sockfd，创建TcpConnection连接对象
     TcpConnectionPtr conn(new TcpConnection(ioloop,
                                 connName,
                                 sockfd,
                                 localAddr,
-                                peerAddr));
-    connections_[connName] = conn;
+                                peerAddr,
+                                connId));
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.connections[connId] = conn;
+    }
 
     // 给TcpConnection对象设置回调，这些都是用户设置给TcpServer的
     conn->setConnectionCallback(connectionCallback_);
     conn->setMessageCallback(messageCallback_);
     conn->setWriteCompleteCallback(writeCompleteCallback_);
+    conn->setEdgeTriggered(edgeTriggered_);
+    conn->setChainedOutput(chainedOutput_);
+    conn->setAutoCork(autoCork_, flushDeadlineUs_);
+    conn->setIdleTimeout(idleTimeoutSec_);
 
     // 设置了如何关闭的回调 当coon->shutdown的时候调用
     conn->setCloseCallback(std::bind(&TcpServer::removeConnection,this,std::placeholders::_1));
-
-    // 直接调用TcpConnection::connectEstablished
-    ioloop->runInLoop(std::bind(&TcpConnection::connectEstablished,conn));
+    return conn;
 }
 
+// 在连接所在的loop中调用（TcpConnection::handleClose），只涉及这个loop的注册表，不经过baseLoop
 void TcpServer::removeConnection(const TcpConnectionPtr &conn)
 {
-    loop_->runInLoop(
-        std::bind(&TcpServer::removeConnectionInLoop, this, conn)
-    );
-}
-
-void TcpServer::removeConnectionInLoop(const TcpConnectionPtr &conn)
-{
-    LOG_INFO("TcpServer::removeConnectionInLoop [%s] - connection %s\n", 
+    LOG_INFO("TcpServer::removeConnection [%s] - connection %s\n", 
         name_.c_str(), conn->name().c_str());
     
-    connections_.erase(conn->name());
+    ConnectionShard& shard = *shards_[conn->id() >> kShardShift];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.connections.erase(conn->id());
+    }
+    // 先减连接数再检查Acceptor是否暂停，和Acceptor暂停以后再检查连接数配对，不能用relaxed
+    numConnections_.fetch_sub(1);
     EventLoop* ioLoop = conn->getLoop();
     ioLoop->queueInLoop(
         std::bind(&TcpConnection::connectDestroyed,conn)
     );
-}
\ No newline at end of file
+    if(handedOff_)
+    {
+        checkDrained();
+    }
+    else if(acceptPause_)
+    {
+        resumeAccept(ioLoop);
+    }
+}
+
+static size_t loopConnections(EventLoop* ioloop)
+{
+    return static_cast<size_t>(ioloop->load().connections());
+}
+
+// 按准入策略决定新连接能不能分到ioloop上，能的话占用一个服务器的连接名额
+bool TcpServer::admit(EventLoop* ioloop)
+{
+    if(maxConnectionsPerLoop_ > 0 && loopConnections(ioloop) >= maxConnectionsPerLoop_)
+    {
+        count(kRejectedLoopLimit);
+        return false;
+    }
+    if(maxPendingFunctors_ > 0 && ioloop->pendingFunctors() >= maxPendingFunctors_)
+    {
+        count(kRejectedQueueDepth);
+        return false;
+    }
+    if(maxUtilization_ > 0 && ioloop->metrics() != nullptr
+        && ioloop->metrics()->recentUtilization() >= maxUtilization_)
+    {
+        count(kRejectedUtilization);
+        return false;
+    }
+    // 多个loop的Acceptor同时检查时，先占名额再比较，超过了再退回
+    size_t connections = numConnections_.fetch_add(1, std::memory_order_relaxed);
+    if(maxConnections_ > 0 && connections >= maxConnections_)
+    {
+        numConnections_.fetch_sub(1, std::memory_order_relaxed);
+        count(kRejectedServerLimit);
+        return false;
+    }
+    count(kAdmitted);
+    return true;
+}
+
+// acceptPause模式下Acceptor每次accept之前调用，ioloop为nullptr时只检查服务器的上限
+// queued是Acceptor本轮已经accept还没有交给TcpServer的连接，还没有计入numConnections_
+bool TcpServer::canAccept(EventLoop* ioloop, size_t queued)
+{
+    bool full = (maxConnections_ > 0 && numConnections_.load() + queued >= maxConnections_)
+        || (ioloop != nullptr && maxConnectionsPerLoop_ > 0 && loopConnections(ioloop) >= maxConnectionsPerLoop_);
+    return !full;
+}
+
+// 连接数降到上限的90%以下再恢复，避免在上限附近反复暂停和恢复
+static bool belowResumeMark(size_t connections, size_t limit)
+{
+    return limit == 0 || connections < limit - limit / 10;
+}
+
+// 有连接断开时检查暂停的Acceptor能不能恢复，leavingLoop上正在断开的连接还没有从它的连接数中减掉
+void TcpServer::resumeAccept(EventLoop* leavingLoop)
+{
+    if(!belowResumeMark(numConnections_.load(std::memory_order_relaxed), maxConnections_))
+    {
+        return;
+    }
+    if(acceptor_->paused())
+    {
+        loop_->runInLoop(std::bind(&Acceptor::resume, acceptor_.get()));
+    }
+    for(auto &acceptor : loopAcceptors_)
+    {
+        EventLoop* ioloop = acceptor->getLoop();
+        size_t connections = loopConnections(ioloop);
+        if(ioloop == leavingLoop && connections > 0)
+        {
+            --connections;
+        }
+        if(acceptor->paused() && belowResumeMark(connections, maxConnectionsPerLoop_))
+        {
+            ioloop->runInLoop(std::bind(&Acceptor::resume, acceptor.get()));
+        }
+    }
+}
+
+// kAcceptPaused由各个Acceptor自己计数，暂停以后的再检查通过时不算暂停
+uint64_t TcpServer::admissionCount(AdmissionCounter counter) const
+{
+    uint64_t n = admissionCounts_[counter].load(std::memory_order_relaxed);
+    if(counter == kAcceptPaused)
+    {
+        n += acceptor_->pauses();
+        for(const auto &acceptor : loopAcceptors_)
+        {
+            n += acceptor->pauses();
+        }
+    }
+    return n;
+}
+
+TcpConnectionPtr TcpServer::getConnection(uint64_t id) const
+{
+    const size_t shardIdx = id >> kShardShift;
+    if(shardIdx >= shards_.size())
+    {
+        return TcpConnectionPtr();
+    }
+    ConnectionShard& shard = *shards_[shardIdx];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ConnectionMap::const_iterator it = shard.connections.find(id);
+    return it != shard.connections.end() ? it->second : TcpConnectionPtr();
+}
+
+// 建立从旧进程继承的连接，和新连接一样选择loop，不经过准入控制
+void TcpServer::establishInherited()
+{
+    for(const Upgrade::Connection &inherited : inheritedConnections_)
+    {
+        sockaddr_in peer;
+        ::bzero(&peer,sizeof peer);
+        socklen_t addrlen = sizeof peer;
+        if(::getpeername(inherited.sockfd,(sockaddr*)&peer,&addrlen) < 0)
+        {
+            // 交接期间对端已经断开了
+            ::close(inherited.sockfd);
+            continue;
+        }
+        InetAddress peerAddr(peer);
+        EventLoop* ioloop = threadPool_->getNextLoop(peerAddr);
+        numConnections_.fetch_add(1, std::memory_order_relaxed);
+        TcpConnectionPtr conn = createConnection(ioloop, inherited.sockfd, peerAddr);
+        ioloop->runInLoop(std::bind(&TcpConnection::connectInherited, conn, inherited.input));
+    }
+    inheritedConnections_.clear();
+}
+
+void TcpServer::enableUpgrade(const std::string &path, bool handOffIdle)
+{
+    if(upgradeFd_ >= 0 || handedOff_)
+    {
+        return;
+    }
+    upgradeFd_ = Upgrade::listen(path);
+    if(upgradeFd_ < 0)
+    {
+        return;
+    }
+    upgradePath_ = path;
+    handOffIdle_ = handOffIdle;
+    upgradeChannel_.reset(new Channel(loop_, upgradeFd_));
+    upgradeChannel_->setReadCallback(std::bind(&TcpServer::handleUpgrade, this));
+    upgradeChannel_->enableReading();
+    LOG_INFO("TcpServer::enableUpgrade [%s] waiting for successor on %s \n", name_.c_str(), path.c_str());
+}
+
+// 各个loop交出的空闲连接，baseLoop等所有loop都处理完
+struct TcpServer::HandOffBatch
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t remaining;
+    std::vector<Upgrade::Connection> connections;
+};
+
+// 新进程连上来了，在baseLoop中同步完成交接，期间baseLoop不处理其他事件
+void TcpServer::handleUpgrade()
+{
+    int channelFd = ::accept4(upgradeFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if(channelFd < 0)
+    {
+        LOG_ERROR("TcpServer::handleUpgrade accept error:%d \n", errno);
+        return;
+    }
+    // 只交接一次，路径留给新进程再监听
+    upgradeChannel_->disableAll();
+    upgradeChannel_->remove();
+    ::close(upgradeFd_);
+    upgradeFd_ = -1;
+    ::unlink(upgradePath_.c_str());
+
+    bool ok = Upgrade::sendListenFd(channelFd, acceptor_->fd());
+    for(auto &acceptor : loopAcceptors_)
+    {
+        ok = ok && Upgrade::sendListenFd(channelFd, acceptor->fd());
+    }
+    if(!ok)
+    {
+        // 新进程拿不到完整的监听socket会放弃，本进程继续服务
+        LOG_ERROR("TcpServer::handleUpgrade [%s] failed to send listening sockets \n", name_.c_str());
+        ::close(channelFd);
+        return;
+    }
+
+    // 监听socket已经在新进程中了，停止accept，排队的连接由新进程accept
+    acceptor_->stop();
+    std::vector<EventLoop*> loops = threadPool_->getAllLoops();
+    HandOffBatch batch;
+    batch.remaining = loops.size();
+    for(EventLoop* ioloop : loops)
+    {
+        ioloop->runInLoop(std::bind(&TcpServer::handOffLoop, this, ioloop, &batch));
+    }
+    {
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        while(batch.remaining > 0)
+        {
+            batch.cond.wait(lock);
+        }
+    }
+
+    for(const Upgrade::Connection &conn : batch.connections)
+    {
+        // 发送失败的连接就断开了，新进程不会收到
+        Upgrade::sendConnection(channelFd, conn.sockfd, conn.input);
+        ::close(conn.sockfd);
+    }
+    Upgrade::sendEnd(channelFd);
+    ::close(channelFd);
+
+    LOG_INFO("TcpServer::handleUpgrade [%s] handed off %zu listening sockets and %zu connections, draining %zu \n",
+        name_.c_str(), loopAcceptors_.size() + 1, batch.connections.size(), numConnections());
+    handedOff_ = true;
+    checkDrained();
+}
+
+// 在ioloop线程中停止它的Acceptor，交出空闲的连接
+void TcpServer::handOffLoop(EventLoop* ioloop, HandOffBatch* batch)
+{
+    for(auto &acceptor : loopAcceptors_)
+    {
+        if(acceptor->getLoop() == ioloop)
+        {
+            acceptor->stop();
+        }
+    }
+
+    std::vector<Upgrade::Connection> handedOff;
+    if(handOffIdle_)
+    {
+        std::vector<TcpConnectionPtr> conns;
+        ConnectionShard& shard = *shards_[shardIndex_.find(ioloop)->second];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for(auto &item : shard.connections)
+            {
+                conns.push_back(item.second);
+            }
+        }
+        // handOff会关闭连接，从注册表中删除，所以先复制出来
+        for(const TcpConnectionPtr &conn : conns)
+        {
+            if(handOffFilter_ && !handOffFilter_(conn))
+            {
+                continue;
+            }
+            Upgrade::Connection inherited;
+            if(conn->handOff(&inherited.sockfd, &inherited.input))
+            {
+                handedOff.push_back(std::move(inherited));
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    for(Upgrade::Connection &conn : handedOff)
+    {
+        batch->connections.push_back(std::move(conn));
+    }
+    if(--batch->remaining == 0)
+    {
+        batch->cond.notify_one();
+    }
+}
+
+// 交接以后连接数降到0时回调一次drainedCallback_
+void TcpServer::checkDrained()
+{
+    if(numConnections_.load(std::memory_order_relaxed) == 0 && !drained_.exchange(true))
+    {
+        LOG_INFO("TcpServer::checkDrained [%s] all connections closed \n", name_.c_str());
+        if(drainedCallback_)
+        {
+            loop_->queueInLoop(drainedCallback_);
+        }
+    }
+}
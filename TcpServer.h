@@ -8,11 +8,14 @@
 #include "Callbacks.h"
 #include "TcpConnection.h"
 #include "Buffer.h"
+#include "Upgrade.h"
 
 #include <functional>
 #include <string>
 #include <memory>
 #include <atomic>
+#include <mutex>
+#include <vector>
 #include <unordered_map>
 
 /**
@@ -23,19 +26,76 @@ class TcpServer
 {
     using ThreadInitCallback = std::function<void(EventLoop*)>;
 
+public:
+    using DrainedCallback = std::function<void()>;
+    // 平滑升级时决定一个空闲连接能不能交给新进程，返回false的连接留在本进程处理完
+    using HandOffFilter = std::function<bool(const TcpConnectionPtr&)>;
+
     enum Option
     {
         kNoReusePort,
         kReusePort,
+        // 每个subloop有自己的SO_REUSEPORT监听socket和Acceptor，由内核分配新连接
+        // 连接就在accept它的loop上处理，不经过baseLoop转发；没有subloop时和kReusePort一样
+        kReusePortPerLoop,
     };
-public:
+
+    // 准入控制的计数，每个新连接的结果记一次，kAcceptPaused记暂停accept的次数
+    enum AdmissionCounter
+    {
+        kAdmitted,              // 建立了连接
+        kRejectedServerLimit,   // 超过服务器的最大连接数，关闭
+        kRejectedLoopLimit,     // 超过所在loop的最大连接数，关闭
+        kRejectedQueueDepth,    // 所在loop积压的回调太多，关闭
+        kRejectedUtilization,   // 所在loop最近的利用率太高，关闭
+        kAcceptPaused,          // 连接数到上限，暂停accept
+        kNumAdmissionCounters,
+    };
+
     TcpServer(EventLoop* loop,
         const InetAddress &listenAddr,
         const std::string &nameArg,
         Option option = kNoReusePort);
+    // 平滑升级的新进程：用Upgrade::receive从旧进程继承的socket构造，监听地址就是继承的监听socket的地址
+    // option要和旧进程一致，继承的连接在start时建立
+    TcpServer(EventLoop* loop,
+        const Upgrade::Sockets &inherited,
+        const std::string &nameArg,
+        Option option = kNoReusePort);
     ~TcpServer();
 
     void setThreadNums(int threadNums);     // 设置底层subloop的个数
+    // 新连接选择subloop的策略，默认轮询，需要在start之前设置，kReusePortPerLoop模式下由内核分配，不使用
+    void setLoadBalance(EventLoopThreadPool::Strategy strategy,
+                        EventLoopThreadPool::LoadMetric metric = EventLoopThreadPool::kLoadConnections)
+    { threadPool_->setStrategy(strategy, metric); }
+    // subloop线程的CPU绑定，见EventLoopThreadPool::setCpuAffinity/setAutoAffinity，需要在start之前设置
+    void setCpuAffinity(const std::vector<std::vector<int>> &cpuLists) { threadPool_->setCpuAffinity(cpuLists); }
+    void setAutoAffinity(bool on) { threadPool_->setAutoAffinity(on); }
+    void setEdgeTriggered(bool on);         // 监听socket和所有连接使用epoll ET模式，需要在start之前设置
+    void setChainedOutput(bool on) { chainedOutput_ = on; } // 新连接的发送缓冲区使用分块的ChainBuffer
+    // 新连接使用自动合并写，见TcpConnection::setAutoCork
+    void setAutoCork(bool on, int flushDeadlineUs = 0) { autoCork_ = on; flushDeadlineUs_ = flushDeadlineUs; }
+
+    // 超过seconds秒没有读写的连接会被关闭，0表示不检查，每个loop用一个1秒粒度的时间轮
+    void setIdleTimeout(int seconds) { idleTimeoutSec_ = seconds; }
+
+    // 准入控制，都需要在start之前设置
+    // 服务器和每个loop的最大连接数，0表示不限制，超过的新连接accept以后马上关闭
+    void setMaxConnections(size_t maxPerServer, size_t maxPerLoop = 0) { maxConnections_ = maxPerServer; maxConnectionsPerLoop_ = maxPerLoop; }
+    // 连接数到上限时暂停accept，而不是accept以后再关闭，连接留在内核的backlog中，连接数降下来以后恢复
+    // 只有一个Acceptor时不知道连接会分到哪个loop，只按服务器的上限暂停
+    void setAcceptPause(bool on) { acceptPause_ = on; }
+    // 分到的loop待执行的回调数（EventLoop::pendingFunctors）超过maxPendingFunctors，
+    // 或者最近的利用率超过maxUtilization（0~1，需要loop打开了统计）时，新连接马上关闭，0表示不检查
+    // 需要在start之前设置，maxPendingFunctors不为0时start会打开各个loop的回调计数
+    void setShedThresholds(size_t maxPendingFunctors, double maxUtilization = 0.0)
+    { maxPendingFunctors_ = maxPendingFunctors; maxUtilization_ = maxUtilization; }
+
+    // 可以在任意线程调用
+    size_t numConnections() const { return numConnections_.load(std::memory_order_relaxed); }
+    // start以后可以在任意线程调用
+    uint64_t admissionCount(AdmissionCounter counter) const;
 
     // 设置回调
     void setThreadInitcallback(const ThreadInitCallback &cb) { threadInitCallback_ = cb; }
@@ -46,18 +106,65 @@ public:
     // 开启服务器监听
     void start();
 
+    // 平滑升级的旧进程：在Unix域socket path上等待新进程（Upgrade::receive），新进程连上来以后交出所有的监听socket，
+    // handOffIdle为true时空闲的连接也连同还没有处理的输入一起交出，之后停止accept，
+    // 剩下的连接都关闭以后在baseLoop中回调drainedCallback（一般在里面退出loop）
+    // 只交接一次，需要在start之后在baseLoop线程中调用
+    // 交出的连接在本进程中关闭，会回调connectionCallback（connected()为false，handedOff()为true）
+    void enableUpgrade(const std::string &path, bool handOffIdle = false);
+    void setDrainedCallback(const DrainedCallback &cb) { drainedCallback_ = cb; }
+    // 空闲只看发送和接收缓冲区，请求交给了工作线程还没有回复的连接也算空闲，
+    // 这类连接需要用handOffFilter留下，否则回复时连接已经关闭了；在连接所在的loop线程中调用
+    void setHandOffFilter(const HandOffFilter &cb) { handOffFilter_ = cb; }
+
+    // 按连接id（TcpConnection::id）查找，已经断开或者不存在返回空，start以后可以在任意线程调用
+    TcpConnectionPtr getConnection(uint64_t id) const;
+
 private:
-    void newConnection(int sockfd, const InetAddress &peerAddr);
+    TcpServer(EventLoop* loop,
+        const InetAddress &listenAddr,
+        const std::string &nameArg,
+        Option option,
+        Acceptor* acceptor);
+
+    // 创建在ioloop上accept的Acceptor，listenfd < 0时新建一个SO_REUSEPORT的socket，由start统一开始listen
+    void addLoopAcceptor(EventLoop* ioloop, int listenfd, bool perLoop);
+    void newConnections(const std::vector<Acceptor::Accepted> &accepted);
+    static void establishConnections(const std::vector<TcpConnectionPtr> &conns);
+    void newConnectionInLoop(EventLoop* ioloop, int sockfd, const InetAddress &peerAddr);
+    TcpConnectionPtr createConnection(EventLoop* ioloop, int sockfd, const InetAddress &peerAddr);
     void removeConnection(const TcpConnectionPtr &conn);
-    void removeConnectionInLoop(const TcpConnectionPtr &conn);
+    bool admit(EventLoop* ioloop);
+    bool canAccept(EventLoop* ioloop, size_t queued);
+    void resumeAccept(EventLoop* leavingLoop);
+    void count(AdmissionCounter counter) { admissionCounts_[counter].fetch_add(1, std::memory_order_relaxed); }
+
+    struct HandOffBatch;
+    void establishInherited();
+    void handleUpgrade();
+    void handOffLoop(EventLoop* ioloop, HandOffBatch* batch);
+    void checkDrained();
     
-    using ConnectionMap = std::unordered_map<std::string, TcpConnectionPtr>;
+    using ConnectionMap = std::unordered_map<uint64_t, TcpConnectionPtr>;
+    // 一个loop上的连接，只有这个loop（以及给它分配连接的线程）增删，互相之间没有竞争
+    struct ConnectionShard
+    {
+        ConnectionShard() : nextSeq(1) {}
+        mutable std::mutex mutex;
+        ConnectionMap connections;
+        std::atomic<uint64_t> nextSeq;
+    };
+    static const int kShardShift = 48;  // 连接id中注册表下标的位置
     
     EventLoop* loop_;       // baseLoop 用户定义的loop
     std::string name_;      
     std::string ipPort_;
+    const std::string connNamePrefix_;  // 连接名字的前缀 name-ip:port#
+    const InetAddress listenAddr_;
+    const Option option_;
 
     std::unique_ptr<Acceptor> acceptor_;    //运行在mainloop，任务监听新用户的连接
+    std::vector<std::unique_ptr<Acceptor>> loopAcceptors_;  // kReusePortPerLoop模式下每个subloop的Acceptor，以及继承的其他监听socket的Acceptor
     std::shared_ptr<EventLoopThreadPool> threadPool_;   // one loop peer thread
 
     ConnectionCallback connectionCallback_; // 有新连接时的回调
@@ -66,8 +173,34 @@ private:
 
     ThreadInitCallback threadInitCallback_; // loop线程初始化的回调
 
+    bool edgeTriggered_;            // 新连接是否使用ET模式
+    bool chainedOutput_;            // 新连接的发送缓冲区是否使用ChainBuffer
+    bool autoCork_;                 // 新连接是否自动合并写
+    int flushDeadlineUs_;
+    int idleTimeoutSec_;            // 新连接的空闲超时，0表示不检查
+
+    size_t maxConnections_;         // 0表示不限制
+    size_t maxConnectionsPerLoop_;
+    bool acceptPause_;
+    size_t maxPendingFunctors_;
+    double maxUtilization_;
+    std::atomic<size_t> numConnections_;
+    std::atomic<uint64_t> admissionCounts_[kNumAdmissionCounters];
+
     std::atomic<int> started_;
-    int nextConnId_;                // 用于分配subloop
-    ConnectionMap connections_;     // 保存所有的连接
+    std::vector<std::unique_ptr<ConnectionShard>> shards_;     // 保存所有的连接，每个loop一个注册表，start以后只读
+    std::unordered_map<EventLoop*, size_t> shardIndex_;     // loop对应的注册表下标，start以后只读
+
+    // 平滑升级
+    std::vector<int> inheritedListenFds_;       // acceptor_之外继承的监听socket，start时分给各个loop
+    std::vector<Upgrade::Connection> inheritedConnections_;    // start时建立
+    std::string upgradePath_;
+    int upgradeFd_;                             // 等待新进程的Unix域socket
+    std::unique_ptr<Channel> upgradeChannel_;
+    bool handOffIdle_;
+    HandOffFilter handOffFilter_;
+    std::atomic<bool> handedOff_;               // 已经交给了新进程，连接数降到0时回调drainedCallback_
+    std::atomic<bool> drained_;
+    DrainedCallback drainedCallback_;
 
 };
\ No newline at end of file
@@ -1,9 +1,22 @@
 #include "Thread.h"
 #include "CurrentThread.h"
 #include <semaphore.h>
+#include <sys/prctl.h>
 
 std::atomic<int> Thread::numCreated_{0};
 
+// 设置调用线程的名字，perf、top -H中显示的就是它
+// 内核限制16个字节（包括结尾的0），超过时保留开头和结尾，结尾通常是线程池里的下标
+static void setCurrentThreadName(const std::string& name)
+{
+    std::string comm = name;
+    if(comm.size() > 15)
+    {
+        comm = name.substr(0, 7) + name.substr(name.size() - 8);
+    }
+    ::prctl(PR_SET_NAME, comm.c_str());
+}
+
 Thread::Thread(ThreadFunc func, const std::string& name)
     : started_(false)
     , joined_(false)
@@ -31,6 +44,7 @@ void Thread::start()
     thread_ = std::shared_ptr<std::thread>(new std::thread([&](){
         // 获取线程的tid
         tid_ = CurrentThread::tid();
+        setCurrentThreadName(name_);
         sem_post(&sem);
         func_();  // 开启一个新线程，专门执行线程函数  包含一个EventLoop
     }));
@@ -1,6 +1,7 @@
 #include "TimeStamp.h"
 
 #include <time.h>
+#include <sys/time.h>
 
 TimeStamp::TimeStamp()
     : microSecondsSinceEpoch_(0) {}
@@ -12,14 +13,18 @@ TimeStamp::TimeStamp(int64_t microSecondsSinceEpochArg)
 
 TimeStamp TimeStamp::now()
 {
-    // 获取当前的时间
-    return TimeStamp(time(NULL));
+    // 获取当前的时间，精确到微秒
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t seconds = tv.tv_sec;
+    return TimeStamp(seconds * kMicroSecondsPerSecond + tv.tv_usec);
 }
 
 std::string TimeStamp::toString() const
 {
     char buf[128] = {0};
-    tm *time = localtime(&microSecondsSinceEpoch_);
+    time_t seconds = static_cast<time_t>(microSecondsSinceEpoch_ / kMicroSecondsPerSecond);
+    tm *time = localtime(&seconds);
     snprintf(buf, 128, "%04d/%02d/%02d %02d:%02d:%02d",
              time->tm_year + 1900,
              time->tm_mon + 1,
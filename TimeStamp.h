@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <string>
+#include <stdint.h>
+
 class TimeStamp
 {
 public:
@@ -12,9 +14,39 @@ public:
     explicit TimeStamp(int64_t microSecondsSinceEpochArg);
 
     static TimeStamp now();
+    static TimeStamp invalid() { return TimeStamp(); }
 
     std::string toString() const;
 
+    bool valid() const { return microSecondsSinceEpoch_ > 0; }
+    int64_t microSecondsSinceEpoch() const { return microSecondsSinceEpoch_; }
+
+    static const int kMicroSecondsPerSecond = 1000 * 1000;
+
 private:
-    int64_t microSecondsSinceEpoch_;
-};
\ No newline at end of file
+    int64_t microSecondsSinceEpoch_;   // 微秒精度，定时器需要比秒更细的分辨率
+};
+
+inline bool operator<(TimeStamp lhs, TimeStamp rhs)
+{
+    return lhs.microSecondsSinceEpoch() < rhs.microSecondsSinceEpoch();
+}
+
+inline bool operator==(TimeStamp lhs, TimeStamp rhs)
+{
+    return lhs.microSecondsSinceEpoch() == rhs.microSecondsSinceEpoch();
+}
+
+// 两个时间点的差值，单位秒
+inline double timeDifference(TimeStamp high, TimeStamp low)
+{
+    int64_t diff = high.microSecondsSinceEpoch() - low.microSecondsSinceEpoch();
+    return static_cast<double>(diff) / TimeStamp::kMicroSecondsPerSecond;
+}
+
+// 在timestamp的基础上增加seconds秒
+inline TimeStamp addTime(TimeStamp timestamp, double seconds)
+{
+    int64_t delta = static_cast<int64_t>(seconds * TimeStamp::kMicroSecondsPerSecond);
+    return TimeStamp(timestamp.microSecondsSinceEpoch() + delta);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "TimeStamp.h"
+#include "Callbacks.h"
+
+#include <atomic>
+
+/*
+* 定时器 封装了到期时间、回调函数以及重复间隔
+* 由TimerQueue管理，heapIndex_记录自己在TimerQueue最小堆中的下标，取消定时器时可以O(logn)删除
+*/
+class Timer : noncopyable
+{
+public:
+    Timer(TimerCallback cb, TimeStamp when, double interval)
+        : callback_(std::move(cb))
+        , expiration_(when)
+        , interval_(interval)
+        , repeat_(interval > 0.0)
+        , sequence_(++s_numCreated_)
+        , heapIndex_(-1)
+    {
+    }
+
+    void run() const { callback_(); }
+
+    TimeStamp expiration() const { return expiration_; }
+    bool repeat() const { return repeat_; }
+    int64_t sequence() const { return sequence_; }
+
+    int heapIndex() const { return heapIndex_; }
+    void setHeapIndex(int idx) { heapIndex_ = idx; }
+
+    // 重复定时器到期以后，根据now重新计算下一次的到期时间
+    void restart(TimeStamp now);
+
+    static int64_t numCreated() { return s_numCreated_; }
+
+private:
+    const TimerCallback callback_;   // 定时器到期执行的回调
+    TimeStamp expiration_;           // 到期时间
+    const double interval_;          // 重复间隔，单位秒，<=0表示只执行一次
+    const bool repeat_;
+    const int64_t sequence_;         // 全局唯一的序号，用于区分地址复用的Timer对象
+    int heapIndex_;                  // 在最小堆中的下标，-1表示不在堆中
+
+    static std::atomic<int64_t> s_numCreated_;
+};
@@ -0,0 +1,262 @@
+#include "TimerQueue.h"
+#include "EventLoop.h"
+#include "Logger.h"
+#include "Timer.h"
+#include "TimerId.h"
+
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+// 创建timerfd，所有的定时器都通过它来唤醒loop
+static int createTimerfd()
+{
+    int timerfd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timerfd < 0)
+    {
+        LOG_FATAL("timerfd_create error:%d \n", errno);
+    }
+    return timerfd;
+}
+
+// 计算when距离现在的时间
+static struct timespec howMuchTimeFromNow(TimeStamp when)
+{
+    int64_t microseconds = when.microSecondsSinceEpoch()
+                            - TimeStamp::now().microSecondsSinceEpoch();
+    if(microseconds < 100)
+    {
+        // 已经到期或者马上到期，timerfd的it_value不能设置为0（0表示关闭定时器）
+        microseconds = 100;
+    }
+    struct timespec ts;
+    ts.tv_sec = static_cast<time_t>(microseconds / TimeStamp::kMicroSecondsPerSecond);
+    ts.tv_nsec = static_cast<long>((microseconds % TimeStamp::kMicroSecondsPerSecond) * 1000);
+    return ts;
+}
+
+// 把timerfd里的计数读出来，否则LT模式下会一直触发
+static void readTimerfd(int timerfd)
+{
+    uint64_t howmany;
+    ssize_t n = ::read(timerfd, &howmany, sizeof howmany);
+    if(n != sizeof howmany)
+    {
+        LOG_ERROR("TimerQueue::handleRead reads %zd bytes instead of 8 \n", n);
+    }
+}
+
+// 重新设置timerfd的到期时间
+static void resetTimerfd(int timerfd, TimeStamp expiration)
+{
+    struct itimerspec newValue;
+    memset(&newValue, 0, sizeof newValue);
+    newValue.it_value = howMuchTimeFromNow(expiration);
+    if(::timerfd_settime(timerfd, 0, &newValue, nullptr) < 0)
+    {
+        LOG_ERROR("timerfd_settime error:%d \n", errno);
+    }
+}
+
+TimerQueue::TimerQueue(EventLoop* loop)
+    : loop_(loop)
+    , timerfd_(createTimerfd())
+    , timerfdChannel_(loop, timerfd_)
+    , callingExpiredTimers_(false)
+{
+    timerfdChannel_.setReadCallback(std::bind(&TimerQueue::handleRead, this));
+    // 和wakeupfd一样，每个loop都监听timerfd的读事件
+    timerfdChannel_.enableReading();
+}
+
+TimerQueue::~TimerQueue()
+{
+    timerfdChannel_.disableAll();
+    timerfdChannel_.remove();
+    ::close(timerfd_);
+
+    for(const Entry& entry : heap_)
+    {
+        delete entry.timer;
+    }
+}
+
+TimerId TimerQueue::addTimer(TimerCallback cb, TimeStamp when, double interval)
+{
+    Timer* timer = new Timer(std::move(cb), when, interval);
+    // 堆只能在loop线程里操作，其他线程添加的定时器交给loop线程处理
+    loop_->runInLoop(std::bind(&TimerQueue::addTimerInLoop, this, timer));
+    return TimerId(timer, timer->sequence());
+}
+
+void TimerQueue::cancel(TimerId timerId)
+{
+    loop_->runInLoop(std::bind(&TimerQueue::cancelInLoop, this, timerId));
+}
+
+void TimerQueue::addTimerInLoop(Timer* timer)
+{
+    activeTimers_[timer->sequence()] = timer;
+
+    // 只有新定时器比堆顶还早到期的时候才需要重新设置timerfd，其他情况不产生系统调用
+    bool earliestChanged = heap_.empty()
+        || timer->expiration().microSecondsSinceEpoch() < heap_[0].when;
+    heapPush(timer);
+
+    if(earliestChanged)
+    {
+        resetTimerfd(timerfd_, timer->expiration());
+    }
+}
+
+void TimerQueue::cancelInLoop(TimerId timerId)
+{
+    auto it = activeTimers_.find(timerId.sequence_);
+    if(it == activeTimers_.end() || it->second != timerId.timer_)
+    {
+        // 定时器已经执行完释放了，或者已经被取消了
+        return;
+    }
+
+    Timer* timer = it->second;
+    if(timer->heapIndex() >= 0)
+    {
+        // 堆顶被删掉的时候不重新设置timerfd，多一次空唤醒，handleRead里会按新的堆顶重新设置
+        heapRemove(timer->heapIndex());
+        activeTimers_.erase(it);
+        delete timer;
+    }
+    else if(callingExpiredTimers_)
+    {
+        // 定时器正在expired_里等待执行或者在回调里取消自己，交给reset处理
+        cancelingTimers_.insert(timerId.sequence_);
+    }
+}
+
+void TimerQueue::handleRead()
+{
+    TimeStamp now(TimeStamp::now());
+    readTimerfd(timerfd_);
+
+    // 把所有到期的定时器从堆顶取出来
+    expired_.clear();
+    const int64_t nowUs = now.microSecondsSinceEpoch();
+    while(!heap_.empty() && heap_[0].when <= nowUs)
+    {
+        expired_.push_back(heap_[0].timer);
+        heapRemove(0);
+    }
+
+    callingExpiredTimers_ = true;
+    cancelingTimers_.clear();
+    for(Timer* timer : expired_)
+    {
+        timer->run();
+    }
+    callingExpiredTimers_ = false;
+
+    reset(now);
+}
+
+void TimerQueue::reset(TimeStamp now)
+{
+    for(Timer* timer : expired_)
+    {
+        if(timer->repeat() && cancelingTimers_.find(timer->sequence()) == cancelingTimers_.end())
+        {
+            timer->restart(now);
+            heapPush(timer);
+        }
+        else
+        {
+            activeTimers_.erase(timer->sequence());
+            delete timer;
+        }
+    }
+    expired_.clear();
+
+    if(!heap_.empty())
+    {
+        resetTimerfd(timerfd_, TimeStamp(heap_[0].when));
+    }
+}
+
+void TimerQueue::heapPush(Timer* timer)
+{
+    Entry entry = { timer->expiration().microSecondsSinceEpoch(), timer };
+    heap_.push_back(entry);
+    heapPlace(static_cast<int>(heap_.size()) - 1, entry);
+    siftUp(static_cast<int>(heap_.size()) - 1);
+}
+
+// 删除下标为idx的节点：用最后一个节点填补空位，再向上或向下调整
+void TimerQueue::heapRemove(int idx)
+{
+    heap_[idx].timer->setHeapIndex(-1);
+    const int last = static_cast<int>(heap_.size()) - 1;
+    if(idx != last)
+    {
+        heapPlace(idx, heap_[last]);
+        heap_.pop_back();
+        siftUp(idx);
+        siftDown(idx);
+    }
+    else
+    {
+        heap_.pop_back();
+    }
+}
+
+void TimerQueue::siftUp(int idx)
+{
+    Entry entry = heap_[idx];
+    while(idx > 0)
+    {
+        int parent = (idx - 1) / kHeapArity;
+        if(heap_[parent].when <= entry.when)
+        {
+            break;
+        }
+        heapPlace(idx, heap_[parent]);
+        idx = parent;
+    }
+    heapPlace(idx, entry);
+}
+
+void TimerQueue::siftDown(int idx)
+{
+    Entry entry = heap_[idx];
+    const int n = static_cast<int>(heap_.size());
+    while(true)
+    {
+        int first = idx * kHeapArity + 1;
+        if(first >= n)
+        {
+            break;
+        }
+        // 在最多kHeapArity个孩子中找到最早到期的，这几个节点在内存中是连续的
+        int last = first + kHeapArity < n ? first + kHeapArity : n;
+        int minChild = first;
+        for(int i = first + 1; i < last; ++i)
+        {
+            if(heap_[i].when < heap_[minChild].when)
+            {
+                minChild = i;
+            }
+        }
+        if(entry.when <= heap_[minChild].when)
+        {
+            break;
+        }
+        heapPlace(idx, heap_[minChild]);
+        idx = minChild;
+    }
+    heapPlace(idx, entry);
+}
+
+void TimerQueue::heapPlace(int idx, const Entry& entry)
+{
+    heap_[idx] = entry;
+    entry.timer->setHeapIndex(idx);
+}
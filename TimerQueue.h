@@ -0,0 +1,73 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "TimeStamp.h"
+#include "Callbacks.h"
+#include "Channel.h"
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+class EventLoop;
+class Timer;
+class TimerId;
+
+/*
+* 定时器队列 每个EventLoop拥有一个
+* 所有定时器共用一个timerfd，timerfd封装成Channel注册到Poller上，始终设置为最早到期的那个定时器的时间
+* 定时器按到期时间保存在一个4叉最小堆中，堆节点直接存放到期时间，比较的时候不需要访问Timer对象
+*/
+class TimerQueue : noncopyable
+{
+public:
+    explicit TimerQueue(EventLoop* loop);
+    ~TimerQueue();
+
+    // 添加定时器，线程安全，可以在其他线程调用
+    TimerId addTimer(TimerCallback cb, TimeStamp when, double interval);
+    // 取消定时器，线程安全
+    void cancel(TimerId timerId);
+
+    size_t size() const { return heap_.size(); }
+
+private:
+    // 堆节点：到期时间(微秒)和对应的定时器
+    struct Entry
+    {
+        int64_t when;
+        Timer* timer;
+    };
+    using TimerHeap = std::vector<Entry>;
+    using TimerList = std::vector<Timer*>;
+
+    void addTimerInLoop(Timer* timer);
+    void cancelInLoop(TimerId timerId);
+
+    // timerfd可读，也就是有定时器到期了
+    void handleRead();
+    // 处理完到期的定时器，重复的定时器重新入堆，其余的释放
+    void reset(TimeStamp now);
+
+    // 最小堆的操作
+    void heapPush(Timer* timer);
+    void heapRemove(int idx);
+    void siftUp(int idx);
+    void siftDown(int idx);
+    void heapPlace(int idx, const Entry& entry);
+
+    static const int kHeapArity = 4;
+
+    EventLoop* loop_;
+    const int timerfd_;
+    Channel timerfdChannel_;
+
+    TimerHeap heap_;        // 按到期时间排序的最小堆
+    TimerList expired_;     // 本轮到期的定时器，复用vector避免每次分配
+
+    // 序号 -> 定时器，cancel的时候用来判断TimerId对应的定时器是否还存在
+    std::unordered_map<int64_t, Timer*> activeTimers_;
+
+    bool callingExpiredTimers_;     // 是否正在执行到期定时器的回调
+    std::unordered_set<int64_t> cancelingTimers_;   // 在回调中被取消的定时器序号
+};
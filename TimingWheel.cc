@@ -0,0 +1,106 @@
+#include "TimingWheel.h"
+#include "EventLoop.h"
+
+TimingWheel::TimingWheel(EventLoop* loop)
+    : loop_(loop)
+    , now_(0)
+    , size_(0)
+    , slots_(kSlots, nullptr)
+{
+    timer_ = loop_->runEvery(1.0, std::bind(&TimingWheel::tick, this));
+}
+
+TimingWheel::~TimingWheel()
+{
+    loop_->cancel(timer_);
+}
+
+void TimingWheel::add(Entry* entry, int timeoutSec, IdleCallback cb)
+{
+    remove(entry);
+    entry->timeout = timeoutSec > 0 ? timeoutSec : 1;
+    entry->lastActive = now_;
+    entry->callback = std::move(cb);
+    link(entry);
+    ++size_;
+}
+
+void TimingWheel::remove(Entry* entry)
+{
+    if(entry->linked)
+    {
+        unlink(entry);
+        --size_;
+    }
+}
+
+// 期限是最近活跃的tick之后timeout+1个tick，保证空闲的时间至少是timeout秒
+void TimingWheel::link(Entry* entry)
+{
+    entry->deadline = entry->lastActive + entry->timeout + 1;
+    Entry*& head = slots_[entry->deadline % kSlots];
+    entry->prev = nullptr;
+    entry->next = head;
+    if(head != nullptr)
+    {
+        head->prev = entry;
+    }
+    head = entry;
+    entry->linked = true;
+}
+
+void TimingWheel::unlink(Entry* entry)
+{
+    if(entry->prev != nullptr)
+    {
+        entry->prev->next = entry->next;
+    }
+    else
+    {
+        slots_[entry->deadline % kSlots] = entry->next;
+    }
+    if(entry->next != nullptr)
+    {
+        entry->next->prev = entry->prev;
+    }
+    entry->prev = nullptr;
+    entry->next = nullptr;
+    entry->linked = false;
+}
+
+void TimingWheel::tick()
+{
+    ++now_;
+    // 先把整个槽摘下来，重新挂的条目可能落回同一个槽
+    Entry*& head = slots_[now_ % kSlots];
+    Entry* entry = head;
+    head = nullptr;
+    while(entry != nullptr)
+    {
+        Entry* next = entry->next;
+        entry->prev = nullptr;
+        entry->next = nullptr;
+        entry->linked = false;
+        if(entry->lastActive + entry->timeout + 1 <= now_)
+        {
+            --size_;
+            expired_.push_back(entry);
+        }
+        else
+        {
+            // 期间活跃过，或者超时比一圈长还没到期
+            link(entry);
+        }
+        entry = next;
+    }
+
+    // 回调（关闭连接）不会同步销毁其他条目的使用者，连接在之后的connectDestroyed中才销毁
+    for(Entry* e : expired_)
+    {
+        if(e->callback)
+        {
+            e->callback();
+        }
+    }
+    expired_.clear();
+}
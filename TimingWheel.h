@@ -0,0 +1,72 @@
+#pragma once
+
+#include "noncopyable.h"
+#include "TimerId.h"
+
+#include <functional>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+class EventLoop;
+
+/*
+* 空闲超时用的时间轮，每个EventLoop一个（EventLoop::timingWheel），槽的粒度是1秒
+* 条目直接嵌在使用者（TcpConnection）里，加入、移除都是链表操作，不分配内存
+* touch只记录最近活跃的tick，不移动条目；条目到了期限所在的槽时再检查，
+* 期间活跃过就按最近活跃的时间挂到新的槽上，所以一个条目每个超时周期最多移动一次
+* 除了size都只能在loop线程调用
+*/
+class TimingWheel : noncopyable
+{
+public:
+    using IdleCallback = std::function<void()>;
+
+    // 超过kSlots秒的超时也可以，期限所在的槽每转一圈检查一次
+    static const int kSlots = 512;
+
+    struct Entry
+    {
+        Entry()
+            : prev(nullptr)
+            , next(nullptr)
+            , lastActive(0)
+            , deadline(0)
+            , timeout(0)
+            , linked(false)
+        {
+        }
+
+        Entry* prev;
+        Entry* next;
+        uint64_t lastActive;    // 最近活跃的tick
+        uint64_t deadline;      // 所在槽的检查时间
+        uint32_t timeout;       // 超时的tick数（秒）
+        bool linked;
+        IdleCallback callback;  // 超时以后回调，条目已经从时间轮中移除
+    };
+
+    explicit TimingWheel(EventLoop* loop);
+    ~TimingWheel();
+
+    // 加入时间轮，超过timeoutSec秒没有touch就回调cb
+    void add(Entry* entry, int timeoutSec, IdleCallback cb);
+    // 不在时间轮中时什么也不做
+    void remove(Entry* entry);
+    // 标记为活跃，O(1)，只写一次条目
+    void touch(Entry* entry) const { entry->lastActive = now_; }
+
+    size_t size() const { return size_; }
+
+private:
+    void tick();
+    void link(Entry* entry);
+    void unlink(Entry* entry);
+
+    EventLoop* loop_;
+    uint64_t now_;      // 已经走过的tick数
+    size_t size_;
+    std::vector<Entry*> slots_;     // 每个槽是一个双向链表
+    std::vector<Entry*> expired_;   // 本次tick超时的条目，复用避免每次分配
+    TimerId timer_;
+};
@@ -0,0 +1,207 @@
+#include "Upgrade.h"
+#include "Logger.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <vector>
+
+static bool fillAddress(const std::string& path, sockaddr_un* addr)
+{
+    if(path.empty() || path.size() >= sizeof addr->sun_path)
+    {
+        LOG_ERROR("Upgrade path %s is empty or too long \n", path.c_str());
+        return false;
+    }
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path.c_str(), path.size());
+    return true;
+}
+
+static void closeSockets(Upgrade::Sockets* sockets)
+{
+    for(int fd : sockets->listenFds)
+    {
+        ::close(fd);
+    }
+    for(const Upgrade::Connection& conn : sockets->connections)
+    {
+        ::close(conn.sockfd);
+    }
+    sockets->listenFds.clear();
+    sockets->connections.clear();
+}
+
+bool Upgrade::receive(const std::string& path, Sockets* sockets)
+{
+    sockaddr_un addr;
+    if(!fillAddress(path, &addr))
+    {
+        return false;
+    }
+    int sockfd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(sockfd < 0)
+    {
+        LOG_ERROR("Upgrade::receive socket error:%d \n", errno);
+        return false;
+    }
+    if(::connect(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0)
+    {
+        // 没有旧进程，正常的首次启动
+        ::close(sockfd);
+        return false;
+    }
+
+    std::vector<char> buf(sizeof(uint32_t) + kMaxInput);
+    bool done = false;
+    while(!done)
+    {
+        iovec iov = { buf.data(), buf.size() };
+        char control[CMSG_SPACE(sizeof(int))];
+        msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        ssize_t n = ::recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        int fd = -1;
+        cmsghdr* cmsg = n >= 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+        if(cmsg != nullptr && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+        }
+        if(n < static_cast<ssize_t>(sizeof(uint32_t)) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+        {
+            LOG_ERROR("Upgrade::receive bad record, n=%zd errno=%d \n", n, errno);
+            if(fd >= 0)
+            {
+                ::close(fd);
+            }
+            break;
+        }
+        uint32_t type = 0;
+        memcpy(&type, buf.data(), sizeof type);
+
+        if(type == kEnd)
+        {
+            done = true;
+        }
+        else if(fd < 0)
+        {
+            LOG_ERROR("Upgrade::receive record %u without fd \n", type);
+            break;
+        }
+        else if(type == kListenFd)
+        {
+            sockets->listenFds.push_back(fd);
+        }
+        else if(type == kConnection)
+        {
+            Connection conn = { fd, std::string(buf.data() + sizeof type, n - sizeof type) };
+            sockets->connections.push_back(std::move(conn));
+        }
+        else
+        {
+            ::close(fd);
+            LOG_ERROR("Upgrade::receive unknown record %u \n", type);
+            break;
+        }
+    }
+    ::close(sockfd);
+
+    if(!done || sockets->listenFds.empty())
+    {
+        closeSockets(sockets);
+        return false;
+    }
+    LOG_INFO("Upgrade::receive %zu listening sockets and %zu connections from %s \n",
+        sockets->listenFds.size(), sockets->connections.size(), path.c_str());
+    return true;
+}
+
+int Upgrade::listen(const std::string& path)
+{
+    sockaddr_un addr;
+    if(!fillAddress(path, &addr))
+    {
+        return -1;
+    }
+    int sockfd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(sockfd < 0)
+    {
+        LOG_ERROR("Upgrade::listen socket error:%d \n", errno);
+        return -1;
+    }
+    ::unlink(path.c_str());
+    if(::bind(sockfd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0 || ::listen(sockfd, 1) < 0)
+    {
+        LOG_ERROR("Upgrade::listen %s error:%d \n", path.c_str(), errno);
+        ::close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+bool Upgrade::sendListenFd(int channelFd, int fd)
+{
+    return sendRecord(channelFd, kListenFd, fd, nullptr, 0);
+}
+
+bool Upgrade::sendConnection(int channelFd, int fd, const std::string& input)
+{
+    return sendRecord(channelFd, kConnection, fd, input.data(), input.size());
+}
+
+bool Upgrade::sendEnd(int channelFd)
+{
+    return sendRecord(channelFd, kEnd, -1, nullptr, 0);
+}
+
+bool Upgrade::sendRecord(int channelFd, RecordType type, int fd, const char* data, size_t len)
+{
+    uint32_t header = type;
+    iovec iov[2];
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof header;
+    iov[1].iov_base = const_cast<char*>(data);
+    iov[1].iov_len = len;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+    if(fd >= 0)
+    {
+        memset(control, 0, sizeof control);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+    }
+
+    ssize_t n;
+    do
+    {
+        n = ::sendmsg(channelFd, &msg, MSG_NOSIGNAL);
+    } while(n < 0 && errno == EINTR);
+    if(n != static_cast<ssize_t>(sizeof header + len))
+    {
+        LOG_ERROR("Upgrade::sendRecord type %d error:%d \n", type, errno);
+        return false;
+    }
+    return true;
+}
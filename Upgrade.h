@@ -0,0 +1,54 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <string>
+#include <vector>
+
+/*
+* 平滑升级（不停机重启）：旧进程把监听socket和空闲连接交给新进程
+* 旧进程：TcpServer::enableUpgrade(path)在path上监听Unix域socket（SOCK_SEQPACKET），等新进程连上来
+* 新进程：Upgrade::receive(path)连接旧进程，通过SCM_RIGHTS拿到所有的fd，再用TcpServer的继承构造函数重建服务器
+* 旧进程发送完以后停止accept，还在处理请求的连接继续处理，全部关闭以后回调TcpServer的drainedCallback
+* 监听socket是同一个，内核队列中还没有accept的连接由新进程accept，不会丢失
+*
+* 每条消息是一个SOCK_SEQPACKET数据报：4字节的类型，后面是数据（连接已经读出来还没有被处理的输入），附带一个fd
+*/
+class Upgrade : noncopyable
+{
+public:
+    // 新进程继承到的socket，fd都设置了FD_CLOEXEC
+    struct Connection
+    {
+        int sockfd;
+        std::string input;  // 旧进程的inputBuffer中还没有被处理的数据
+    };
+    struct Sockets
+    {
+        std::vector<int> listenFds;     // 第一个是旧进程TcpServer::acceptor_的socket，之后是每个subloop的
+        std::vector<Connection> connections;
+    };
+
+    // 随连接一起转交的输入最多这么多字节，更多的连接当作忙的连接留在旧进程中处理完
+    static const size_t kMaxInput = 64 * 1024;
+
+    // 新进程：连接旧进程的升级socket接收所有的socket，没有旧进程或者中途出错返回false，不会留下打开的fd
+    static bool receive(const std::string& path, Sockets* sockets);
+
+    // 旧进程（TcpServer）使用
+    // 在path上创建非阻塞的监听socket，path已经存在时先删除，失败返回-1
+    static int listen(const std::string& path);
+    static bool sendListenFd(int channelFd, int fd);
+    static bool sendConnection(int channelFd, int fd, const std::string& input);
+    static bool sendEnd(int channelFd);
+
+private:
+    enum RecordType
+    {
+        kListenFd = 1,
+        kConnection = 2,
+        kEnd = 3,
+    };
+
+    static bool sendRecord(int channelFd, RecordType type, int fd, const char* data, size_t len);
+};
@@ -0,0 +1,430 @@
+#include "UringPoller.h"
+#include "Logger.h"
+#include "Channel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+
+// channel未添加到poller中
+const int kNew = -1;
+// channel已添加到poller中
+const int kAdded = 1;
+// channel对任何事件都不感兴趣了
+const int kDelete = 2;
+
+// POLL_ADD只认识poll的事件位，EPOLLIN/EPOLLOUT等和POLLIN/POLLOUT的取值相同，其余的标志位要去掉
+const uint32_t kPollMask = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLRDHUP | EPOLLERR | EPOLLHUP;
+
+// POLL_REMOVE请求自己的user_data，完成的时候直接忽略
+const uint64_t kRemoveUserData = 0;
+
+static int sysIoUringSetup(unsigned entries, io_uring_params* p)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sysIoUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                           unsigned flags, void* arg, size_t argsz)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argsz));
+}
+
+UringPoller::UringPoller(EventLoop *loop)
+    : Poller(loop)
+    , ringfd_(-1)
+    , ringPtr_(MAP_FAILED)
+    , ringSize_(0)
+    , sqes_(static_cast<io_uring_sqe*>(MAP_FAILED))
+    , sqesSize_(0)
+    , toSubmit_(0)
+    , nextGen_(0)
+    , multishotPoll_(false)
+{
+    if(!setupRing())
+    {
+        LOG_ERROR("UringPoller setup failed:%d \n", errno);
+    }
+}
+
+UringPoller::~UringPoller()
+{
+    if(sqes_ != MAP_FAILED)
+    {
+        ::munmap(sqes_, sqesSize_);
+    }
+    if(ringPtr_ != MAP_FAILED)
+    {
+        ::munmap(ringPtr_, ringSize_);
+    }
+    if(ringfd_ >= 0)
+    {
+        ::close(ringfd_);
+    }
+}
+
+bool UringPoller::setupRing()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof params);
+    params.flags = IORING_SETUP_CLAMP;
+
+    int fd = sysIoUringSetup(kRingEntries, &params);
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    // 需要SQ/CQ共用一次mmap，以及io_uring_enter支持带超时的等待（5.11+）
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+    {
+        ::close(fd);
+        errno = ENOSYS;
+        return false;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ringSize_ = sqSize > cqSize ? sqSize : cqSize;
+    ringPtr_ = ::mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(ringPtr_ == MAP_FAILED)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = ::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+    {
+        ::munmap(ringPtr_, ringSize_);
+        ringPtr_ = MAP_FAILED;
+        ::close(fd);
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* ring = static_cast<char*>(ringPtr_);
+    sqHead_ = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+    sqArray_ = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+    sqEntries_ = params.sq_entries;
+
+    cqHead_ = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+
+    ringfd_ = fd;
+    multishotPoll_ = probeMultishotPoll();
+    return true;
+}
+
+// multishot poll要5.13以后才支持，之前的内核对带IORING_POLL_ADD_MULTI的POLL_ADD返回-EINVAL，
+// 没有对应的feature标志，只能实际提交一次：对一个可读的pipe提交multishot的POLL_ADD，看第一个完成事件
+bool UringPoller::probeMultishotPoll()
+{
+    int fds[2];
+    if(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        return false;
+    }
+    bool supported = false;
+    if(::write(fds[1], "x", 1) == 1)
+    {
+        // gen为0的user_data不会和任何注册冲突，探测产生的完成事件在返回之前都会被取走
+        const uint64_t probeUserData = makeUserData(fds[0], 0);
+        io_uring_sqe* sqe = getSqe();
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fds[0];
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = probeUserData;
+
+        bool removing = false;
+        bool finished = false;
+        while(!finished)
+        {
+            int ret = sysIoUringEnter(ringfd_, toSubmit_, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if(ret < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                LOG_ERROR("UringPoller::probeMultishotPoll io_uring_enter error:%d \n", errno);
+                break;
+            }
+            toSubmit_ -= static_cast<unsigned>(ret) < toSubmit_ ? ret : toSubmit_;
+
+            unsigned head = *cqHead_;
+            unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+            for(; head != tail; ++head)
+            {
+                const io_uring_cqe& cqe = cqes_[head & cqMask_];
+                if(cqe.user_data != probeUserData)
+                {
+                    continue;
+                }
+                if(cqe.res > 0 && (cqe.flags & IORING_CQE_F_MORE))
+                {
+                    supported = true;
+                }
+                if(!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    finished = true;
+                }
+            }
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+
+            // 支持的时候请求还挂着，取消掉，等它最后一个完成事件
+            if(!finished && !removing)
+            {
+                io_uring_sqe* remove = getSqe();
+                remove->opcode = IORING_OP_POLL_REMOVE;
+                remove->fd = -1;
+                remove->addr = probeUserData;
+                remove->user_data = kRemoveUserData;
+                removing = true;
+            }
+        }
+    }
+    ::close(fds[0]);
+    ::close(fds[1]);
+    return supported;
+}
+
+TimeStamp UringPoller::poll(int timeoutMs, ChannelList *activeChannels)
+{
+    LOG_INFO("fd total count:%d \n", (int)channels_.size());
+
+    // 上一轮的事件变化和重新挂载的poll请求，和这次等待一起提交
+    flushChanges();
+    int ret = submitAndWait(timeoutMs);
+    int saveErrno = errno;
+
+    TimeStamp now(TimeStamp::now());
+
+    int numEvents = fillActiveChannels(activeChannels);
+    if(numEvents > 0)
+    {
+        LOG_INFO("%d events happened \n", numEvents);
+    }
+    else if(ret >= 0 || saveErrno == ETIME || saveErrno == EINTR)
+    {
+        LOG_DEBUG("nothing happend ! \n");
+    }
+    else
+    {
+        errno = saveErrno;
+        LOG_ERROR("UringPoller::poll err:%d \n", saveErrno);
+    }
+    return now;
+}
+
+void UringPoller::updateChannel(Channel *channel)
+{
+    const int index = channel->index();
+    const int fd = channel->fd();
+    LOG_INFO("fd = %d event=%d index=%d \n", fd, channel->events(), index);
+    if(index == kNew)
+    {
+        channels_[fd] = channel;
+        FdState state = { 0, 0, false };
+        fdStates_[fd] = state;
+    }
+    channel->set_index(channel->isNoneEvent() ? kDelete : kAdded);
+
+    // 这里不产生系统调用，下一次poll的时候统一提交
+    markDirty(fd, fdStates_[fd]);
+}
+
+void UringPoller::removeChannel(Channel *channel)
+{
+    int fd = channel->fd();
+    channels_.erase(fd);
+
+    FdStateMap::iterator it = fdStates_.find(fd);
+    if(it != fdStates_.end())
+    {
+        if(it->second.armedEvents != 0)
+        {
+            // fd马上可能被close并复用，取消请求要在这之前排进队列，它和之后同一个fd的POLL_ADD按顺序提交
+            prepPollRemove(fd, it->second);
+        }
+        fdStates_.erase(it);
+    }
+    channel->set_index(kNew);
+}
+
+void UringPoller::markDirty(int fd, FdState& state)
+{
+    if(!state.dirty)
+    {
+        state.dirty = true;
+        dirty_.push_back(fd);
+    }
+}
+
+void UringPoller::flushChanges()
+{
+    for(int fd : dirty_)
+    {
+        FdStateMap::iterator it = fdStates_.find(fd);
+        if(it == fdStates_.end() || !it->second.dirty)
+        {
+            // 已经被remove了，或者同一个fd重复出现在列表中
+            continue;
+        }
+        FdState& state = it->second;
+        state.dirty = false;
+
+        ChannelMap::const_iterator ch = channels_.find(fd);
+        uint32_t desired = ch == channels_.end() ? 0 : (ch->second->events() & (kPollMask | EPOLLET));
+        if(state.armedEvents == desired)
+        {
+            continue;
+        }
+        if(state.armedEvents != 0)
+        {
+            prepPollRemove(fd, state);
+            state.armedEvents = 0;
+        }
+        if(desired != 0)
+        {
+            prepPollAdd(fd, state, desired);
+        }
+    }
+    dirty_.clear();
+}
+
+int UringPoller::fillActiveChannels(ChannelList* activeChannels)
+{
+    int numEvents = 0;
+    unsigned head = *cqHead_;
+    unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    while(head != tail)
+    {
+        const io_uring_cqe& cqe = cqes_[head & cqMask_];
+        ++head;
+        if(cqe.user_data == kRemoveUserData)
+        {
+            continue;
+        }
+
+        int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+        uint32_t gen = static_cast<uint32_t>(cqe.user_data >> 32);
+        FdStateMap::iterator it = fdStates_.find(fd);
+        if(it == fdStates_.end() || it->second.gen != gen)
+        {
+            // 已经被取消或者替换掉的注册
+            continue;
+        }
+
+        // 一次性的POLL_ADD触发以后要在下一轮poll重新挂上，这样保持和epoll LT一样的语义
+        // ET的channel用的是multishot，只有内核终止了请求（没有IORING_CQE_F_MORE）才需要重新挂
+        if(!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            it->second.armedEvents = 0;
+            markDirty(fd, it->second);
+        }
+
+        ChannelMap::const_iterator ch = channels_.find(fd);
+        if(ch != channels_.end())
+        {
+            ch->second->set_revents(cqe.res < 0 ? static_cast<int>(EPOLLERR) : cqe.res);
+            activeChannels->push_back(ch->second);
+            ++numEvents;
+        }
+    }
+    __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+    return numEvents;
+}
+
+io_uring_sqe* UringPoller::getSqe()
+{
+    unsigned tail = *sqTail_;
+    if(tail - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+    {
+        // SQ满了，先把已有的请求提交掉
+        int ret = sysIoUringEnter(ringfd_, toSubmit_, 0, 0, nullptr, 0);
+        if(ret < 0)
+        {
+            LOG_FATAL("io_uring_enter submit error:%d \n", errno);
+        }
+        toSubmit_ -= static_cast<unsigned>(ret) < toSubmit_ ? ret : toSubmit_;
+    }
+
+    unsigned idx = tail & sqMask_;
+    io_uring_sqe* sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof *sqe);
+    sqArray_[idx] = idx;
+    __atomic_store_n(sqTail_, tail + 1, __ATOMIC_RELEASE);
+    ++toSubmit_;
+    return sqe;
+}
+
+void UringPoller::prepPollAdd(int fd, FdState& state, uint32_t events)
+{
+    // user_data为0留给POLL_REMOVE
+    if(++nextGen_ == 0)
+    {
+        ++nextGen_;
+    }
+    state.gen = nextGen_;
+    state.armedEvents = events;
+
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events & kPollMask;
+    if((events & EPOLLET) && multishotPoll_)
+    {
+        // ET模式的channel会读写到EAGAIN，用multishot只在有新的唤醒时通知，不需要每次重新提交
+        // 内核不支持multishot时和LT一样用一次性的POLL_ADD，每次触发以后重新提交
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+    sqe->user_data = makeUserData(fd, state.gen);
+}
+
+void UringPoller::prepPollRemove(int fd, const FdState& state)
+{
+    io_uring_sqe* sqe = getSqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = makeUserData(fd, state.gen);
+    sqe->user_data = kRemoveUserData;
+}
+
+// 提交所有请求并等待至少一个完成事件，只有一次系统调用
+int UringPoller::submitAndWait(int timeoutMs)
+{
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof arg);
+    arg.sigmask_sz = _NSIG / 8;
+    if(timeoutMs >= 0)
+    {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+
+    int ret = sysIoUringEnter(ringfd_, toSubmit_, 1,
+                              IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                              &arg, sizeof arg);
+    if(ret >= 0)
+    {
+        toSubmit_ -= static_cast<unsigned>(ret) < toSubmit_ ? ret : toSubmit_;
+    }
+    return ret;
+}
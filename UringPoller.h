@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Poller.h"
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/*
+* 基于io_uring的Poller实现，对外保持和EpollPoller一样的updateChannel/removeChannel/poll语义（LT）
+* updateChannel/removeChannel不产生系统调用，只是记录下来，
+* 到下一次poll的时候把所有的POLL_ADD/POLL_REMOVE和等待事件合并成一次io_uring_enter
+*
+* LT的channel使用一次性的POLL_ADD，触发后重新提交；ET的channel使用multishot poll（5.13+，不支持时也用一次性的）
+*
+* 设置环境变量MUDUO_USE_URING启用，内核不支持io_uring的时候退回到EpollPoller
+*/
+class UringPoller : public Poller
+{
+public:
+    UringPoller(EventLoop *loop);
+    ~UringPoller() override;
+
+    // io_uring是否创建成功
+    bool valid() const { return ringfd_ >= 0; }
+
+    //重写基类Poller的抽象方法
+    TimeStamp poll(int timeoutMs, ChannelList *activeChannels) override;
+    void updateChannel(Channel *channel) override;
+    void removeChannel(Channel *channel) override;
+
+private:
+    static const unsigned kRingEntries = 256;
+
+    // 每个fd在ring中的注册状态
+    struct FdState
+    {
+        uint32_t gen;           // 注册的代数，编码在user_data里，用来过滤旧注册产生的cqe
+        uint32_t armedEvents;   // 当前提交给内核的事件，0表示没有挂起的poll请求
+        bool dirty;             // 是否已经在dirty_列表中，等待下一次poll时同步给内核
+    };
+    using FdStateMap = std::unordered_map<int, FdState>;
+
+    bool setupRing();
+    bool probeMultishotPoll();
+    void markDirty(int fd, FdState& state);
+    // 把dirty_列表中fd的感兴趣事件同步成POLL_ADD/POLL_REMOVE请求
+    void flushChanges();
+    // 处理完成队列，填写活跃的连接
+    int fillActiveChannels(ChannelList* activeChannels);
+
+    io_uring_sqe* getSqe();
+    void prepPollAdd(int fd, FdState& state, uint32_t events);
+    void prepPollRemove(int fd, const FdState& state);
+    int submitAndWait(int timeoutMs);
+
+    static uint64_t makeUserData(int fd, uint32_t gen)
+    {
+        return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd);
+    }
+
+    int ringfd_;
+
+    // SQ/CQ环形队列，mmap到用户态的共享内存
+    void* ringPtr_;
+    size_t ringSize_;
+    io_uring_sqe* sqes_;
+    size_t sqesSize_;
+
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned sqMask_;
+    unsigned* sqArray_;
+    unsigned sqEntries_;
+    unsigned toSubmit_;         // 已经填好还没有提交的sqe个数
+
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned cqMask_;
+    io_uring_cqe* cqes_;
+
+    uint32_t nextGen_;
+    bool multishotPoll_;        // 内核是否支持IORING_POLL_ADD_MULTI
+    FdStateMap fdStates_;
+    std::vector<int> dirty_;    // 感兴趣事件需要重新提交的fd
+};
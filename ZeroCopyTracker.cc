@@ -0,0 +1,93 @@
+#include "ZeroCopyTracker.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+ZeroCopyTracker::ZeroCopyTracker()
+    : nextSeq_(0)
+    , completed_(0)
+    , copied_(0)
+{
+}
+
+void ZeroCopyTracker::sent(const Payload& payload)
+{
+    Entry entry = { payload, false };
+    entries_.push_back(entry);
+    ++nextSeq_;
+}
+
+void ZeroCopyTracker::complete(uint32_t lo, uint32_t hi, bool copied)
+{
+    // 编号是32位的，会回绕，都用无符号差值计算下标
+    const uint32_t firstSeq = nextSeq_ - static_cast<uint32_t>(entries_.size());
+    for(uint32_t seq = lo; ; ++seq)
+    {
+        uint32_t idx = seq - firstSeq;
+        if(idx < entries_.size() && !entries_[idx].done)
+        {
+            entries_[idx].done = true;
+            entries_[idx].payload.reset();  // 内核不再引用这块内存了
+            ++completed_;
+            if(copied)
+            {
+                ++copied_;
+            }
+        }
+        if(seq == hi)
+        {
+            break;
+        }
+    }
+
+    // 通知一般是按顺序到达的，从队首开始回收
+    while(!entries_.empty() && entries_.front().done)
+    {
+        entries_.pop_front();
+    }
+}
+
+int ZeroCopyTracker::drainErrorQueue(int sockfd)
+{
+    int notifications = 0;
+    while(true)
+    {
+        char control[128];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof msg);
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof control;
+
+        if(::recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            break;  // EAGAIN，错误队列已经读空了
+        }
+
+        for(struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if(!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+            {
+                continue;
+            }
+            struct sock_extended_err serr;
+            memcpy(&serr, CMSG_DATA(cm), sizeof serr);
+            if(serr.ee_errno == 0 && serr.ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+            {
+                complete(serr.ee_info, serr.ee_data, serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+                ++notifications;
+            }
+        }
+    }
+    return notifications;
+}
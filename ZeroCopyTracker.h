@@ -0,0 +1,48 @@
+#pragma once
+
+#include "noncopyable.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* MSG_ZEROCOPY发送的完成跟踪，每个TcpConnection一个
+* 内核对每次成功的零拷贝sendmsg按0,1,2...编号，发送完成以后在socket的错误队列中通知一个编号区间[lo, hi]
+* 完成之前内核还在引用用户的内存，所以每次发送都持有一份payload的引用计数，完成以后才释放
+* 只在loop线程中使用
+*/
+class ZeroCopyTracker : noncopyable
+{
+public:
+    using Payload = std::shared_ptr<const std::string>;
+
+    ZeroCopyTracker();
+
+    // 一次MSG_ZEROCOPY的sendmsg成功（返回值大于0）以后调用
+    void sent(const Payload& payload);
+    // 从sockfd的错误队列中读取所有的完成通知，返回读到的零拷贝通知个数
+    int drainErrorQueue(int sockfd);
+
+    // 还没有完成的发送次数
+    size_t pending() const { return entries_.size(); }
+    // 已经完成的发送次数，以及其中内核退回到拷贝发送的次数（比如回环地址），退回得多说明不适合零拷贝
+    uint64_t completed() const { return completed_; }
+    uint64_t copied() const { return copied_; }
+
+private:
+    void complete(uint32_t lo, uint32_t hi, bool copied);
+
+    struct Entry
+    {
+        Payload payload;
+        bool done;
+    };
+
+    uint32_t nextSeq_;              // 下一次发送的编号，和内核的计数保持一致
+    std::deque<Entry> entries_;     // 编号从nextSeq_ - entries_.size()开始的未完成发送
+    uint64_t completed_;
+    uint64_t copied_;
+};
@@ -0,0 +1,95 @@
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/EventLoopThread.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+
+/*
+* 跨线程投递回调的微基准：统计每次queueInLoop的堆内存分配次数和吞吐
+* 回调捕获一个shared_ptr，和TcpServer::newConnection、TcpConnection::send投递的回调大小相同
+* 只统计投递线程上的分配，loop线程里打印日志的分配不算在内
+*/
+
+static std::atomic<long> g_allocs{0};
+static thread_local bool t_counting = false;
+
+void* operator new(size_t size)
+{
+    if(t_counting)
+    {
+        g_allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* p = malloc(size);
+    if(p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+struct Session
+{
+    long handled = 0;
+    void onTask() { ++handled; }
+};
+
+int main(int argc, char* argv[])
+{
+    const long kRounds = argc > 1 ? atol(argv[1]) : 1000000;
+
+    EventLoopThread thread;
+    EventLoop* loop = thread.startLoop();
+    std::shared_ptr<Session> session(new Session);
+
+    auto post = [&](long n)
+    {
+        for(long i = 0; i < n; ++i)
+        {
+            loop->queueInLoop(std::bind(&Session::onTask, session));
+        }
+        // 等loop把回调全部执行完
+        std::atomic<bool> done(false);
+        loop->queueInLoop([&done]() { done.store(true, std::memory_order_release); });
+        while(!done.load(std::memory_order_acquire))
+        {
+        }
+    };
+
+    t_counting = true;
+
+    // 预热，让回调节点的缓存稳定下来
+    post(kRounds);
+
+    long allocsBefore = g_allocs.load();
+    auto start = std::chrono::steady_clock::now();
+    post(kRounds);
+    auto end = std::chrono::steady_clock::now();
+    long allocs = g_allocs.load() - allocsBefore;
+
+    double sec = std::chrono::duration<double>(end - start).count();
+    printf("sizeof(std::bind(&Session::onTask, shared_ptr)) = %zu bytes\n",
+           sizeof(std::bind(&Session::onTask, session)));
+    printf("posts: %ld  heap allocations: %ld (%.3f per post)\n",
+           kRounds, allocs, static_cast<double>(allocs) / kRounds);
+    printf("throughput: %.0f posts/sec\n", kRounds / sec);
+
+    // 同样的回调放进std::function需要分配堆内存
+    allocsBefore = g_allocs.load();
+    for(long i = 0; i < 1000; ++i)
+    {
+        std::function<void()> f(std::bind(&Session::onTask, session));
+    }
+    printf("std::function<void()> for the same callable: %.3f allocations per construction\n",
+           (g_allocs.load() - allocsBefore) / 1000.0);
+    return 0;
+}
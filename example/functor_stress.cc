@@ -0,0 +1,123 @@
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/EventLoopThread.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+/*
+* 多线程投递回调的压力测试：检查queueInLoop投递的回调不会卡在队列里
+* 多个投递线程每轮各投递一批回调，然后全部停下来等这一轮执行完，这时没有别的投递能把卡住的回调带出来
+* 另一个线程不停地给投递线程和loop线程发信号，信号处理函数里睡一小会，
+* 模拟线程在push的两步之间（交换了队尾，还没有链接上前一个节点）、或者在pop中途被抢占
+* 用法：functor_stress [轮数] [投递线程数] [每轮每个线程投递的回调数]
+*/
+
+static void stall(int)
+{
+    // 睡0~200us，nanosleep可以在信号处理函数中调用
+    timespec ts = { 0, (rand() % 200) * 1000L };
+    nanosleep(&ts, nullptr);
+}
+
+int main(int argc, char* argv[])
+{
+    const long kRounds = argc > 1 ? atol(argv[1]) : 20000;
+    const int kProducers = argc > 2 ? atoi(argv[2]) : 4;
+    const long kBurst = argc > 3 ? atol(argv[3]) : 16;
+
+    signal(SIGUSR1, stall);
+
+    EventLoopThread thread;
+    EventLoop* loop = thread.startLoop();
+    pthread_t loopThread = 0;
+    {
+        std::atomic<bool> got{false};
+        loop->runInLoop([&]{ loopThread = pthread_self(); got = true; });
+        while(!got)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    std::atomic<long> executed{0};
+    std::atomic<long> round{0};
+    std::atomic<int> arrived{0};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> stuck{false};
+
+    std::vector<pthread_t> producerThreads(kProducers);
+    std::vector<std::thread> producers;
+    for(int p = 0; p < kProducers; ++p)
+    {
+        producers.emplace_back([&, p]
+        {
+            producerThreads[p] = pthread_self();
+            for(long r = 0; r < kRounds && !stuck; ++r)
+            {
+                for(long i = 0; i < kBurst; ++i)
+                {
+                    loop->queueInLoop([&]{ executed.fetch_add(1, std::memory_order_relaxed); });
+                }
+                // 所有线程都投递完以后由最后一个线程检查这一轮是不是全部执行了
+                if(arrived.fetch_add(1) + 1 == kProducers)
+                {
+                    const long expected = (r + 1) * kProducers * kBurst;
+                    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+                    while(executed.load() < expected)
+                    {
+                        if(std::chrono::steady_clock::now() > deadline)
+                        {
+                            printf("STUCK round %ld: executed %ld of %ld\n", r, executed.load(), expected);
+                            stuck = true;
+                            break;
+                        }
+                        std::this_thread::yield();
+                    }
+                    arrived = 0;
+                    round.fetch_add(1);
+                }
+                else
+                {
+                    while(round.load() == r && !stuck)
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        });
+    }
+
+    // 随机打断投递线程和loop线程
+    std::thread interrupter([&]
+    {
+        usleep(10000);
+        while(!stop)
+        {
+            int target = rand() % (kProducers + 1);
+            pthread_kill(target == kProducers ? loopThread : producerThreads[target], SIGUSR1);
+            usleep(50 + rand() % 200);
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    for(std::thread& t : producers)
+    {
+        t.join();
+    }
+    stop = true;
+    interrupter.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%s rounds=%ld producers=%d burst=%ld executed=%ld %.2fs\n",
+        stuck ? "FAIL" : "OK", round.load(), kProducers, kBurst, executed.load(), seconds);
+    return stuck ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+#include <mymuduo/Buffer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+/*
+* 行分隔符查找的微基准：onMessage中逐字节找"\r\n"和Buffer::findCRLF/findEOL的对比
+* Buffer中放满Redis风格的行，每种方法把所有行拆一遍，统计每行耗时和扫描速度
+* 默认的CMake配置没有打开优化，测之前用cmake -DCMAKE_BUILD_TYPE=Release编译mymuduo
+*/
+
+static const char* naiveFindCRLF(const char* begin, const char* end)
+{
+    for(const char* p = begin; p + 1 < end; ++p)
+    {
+        if(p[0] == '\r' && p[1] == '\n')
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+static const char* naiveFindEOL(const char* begin, const char* end)
+{
+    for(const char* p = begin; p < end; ++p)
+    {
+        if(*p == '\n')
+        {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+static void fill(Buffer* buf, size_t lineLen, size_t bytes)
+{
+    std::string line(lineLen, 'x');
+    for(size_t i = 0; i < lineLen; ++i)
+    {
+        line[i] = 'a' + i % 26;
+    }
+    line += "\r\n";
+    while(buf->readableBytes() < bytes)
+    {
+        buf->append(line.data(), line.size());
+    }
+}
+
+template<typename Find>
+static void run(const char* name, const Buffer& buf, int rounds, Find find)
+{
+    size_t lines = 0;
+    size_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r)
+    {
+        const char* p = buf.peek();
+        const char* end = buf.beginWrite();
+        const char* eol;
+        while((eol = find(buf, p, end)) != nullptr)
+        {
+            checksum += eol - p;
+            p = eol + 2;
+            ++lines;
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    double bytes = static_cast<double>(buf.readableBytes()) * rounds;
+    printf("  %-10s %8.1f ns/line %8.2f GB/s (checksum %zu)\n", name, ns / lines, bytes / ns, checksum);
+}
+
+int main(int argc, char* argv[])
+{
+    const int rounds = argc > 1 ? atoi(argv[1]) : 50;
+    const size_t lineLens[] = {16, 64, 256, 1024, 8192};
+
+    for(size_t lineLen : lineLens)
+    {
+        Buffer buf;
+        fill(&buf, lineLen, 4 * 1024 * 1024);
+        printf("line length %zu:\n", lineLen);
+        run("naive-crlf", buf, rounds,
+            [](const Buffer&, const char* p, const char* end) { return naiveFindCRLF(p, end); });
+        run("findCRLF", buf, rounds,
+            [](const Buffer& b, const char* p, const char*) { return b.findCRLF(p); });
+        run("naive-eol", buf, rounds,
+            [](const Buffer&, const char* p, const char* end) { const char* e = naiveFindEOL(p, end); return e ? e - 1 : e; });
+        run("findEOL", buf, rounds,
+            [](const Buffer& b, const char* p, const char*) { const char* e = b.findEOL(p); return e ? e - 1 : e; });
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/TcpConnection.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/Buffer.h>
+#include <mymuduo/SpliceRelay.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+* 四层代理的吞吐：代理把先后接入的两个连接配成一对（client和backend），client不断写，backend读
+* 比较两种转发方式：
+*   copy    onMessage中peer->send(buf)，数据从内核拷贝到inputBuffer，再拷贝到peer的发送缓冲区，再拷贝回内核
+*   splice  SpliceRelay::relay，socket -> pipe -> socket，数据不经过用户态
+* 用法：proxy_bench [总MB数] [代理的线程数]，线程数>=2时一对连接在不同的loop上
+* 默认的CMake配置没有打开优化，测之前用cmake -DCMAKE_BUILD_TYPE=Release编译mymuduo
+*/
+
+static const uint16_t kPort = 9982;
+
+static int connectProxy()
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    while(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0)
+    {
+        usleep(10000);
+    }
+    return fd;
+}
+
+class Proxy
+{
+public:
+    Proxy(EventLoop* loop, int threads)
+        : server_(loop, InetAddress(kPort), "ProxyBench")
+        , splice_(false)
+    {
+        server_.setThreadNums(threads);
+        server_.setConnectionCallback(std::bind(&Proxy::onConnection, this, std::placeholders::_1));
+        server_.setMessageCallback(std::bind(&Proxy::onMessage, this,
+            std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    }
+
+    void start() { server_.start(); }
+    void setSplice(bool on) { splice_ = on; }
+
+private:
+    void onConnection(const TcpConnectionPtr& conn)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!conn->connected())
+        {
+            peers_.erase(conn.get());
+            return;
+        }
+        if(!waiting_)
+        {
+            waiting_ = conn;
+            return;
+        }
+        if(splice_)
+        {
+            SpliceRelay::relay(waiting_, conn);
+        }
+        else
+        {
+            peers_[waiting_.get()] = conn;
+            peers_[conn.get()] = waiting_;
+        }
+        waiting_.reset();
+    }
+
+    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, TimeStamp)
+    {
+        TcpConnectionPtr peer;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::map<TcpConnection*, std::weak_ptr<TcpConnection> >::iterator it = peers_.find(conn.get());
+            if(it != peers_.end())
+            {
+                peer = it->second.lock();
+            }
+        }
+        // 还没有配对的数据留在inputBuffer中，配对以后再转发
+        if(peer)
+        {
+            peer->send(buf);
+        }
+    }
+
+    TcpServer server_;
+    std::atomic<bool> splice_;
+    std::mutex mutex_;
+    TcpConnectionPtr waiting_;
+    std::map<TcpConnection*, std::weak_ptr<TcpConnection> > peers_;
+};
+
+static void run(const char* name, size_t total)
+{
+    int client = connectProxy();
+    int backend = connectProxy();
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread writer([client, total]() {
+        std::vector<char> buf(256 * 1024, 'x');
+        size_t sent = 0;
+        while(sent < total)
+        {
+            ssize_t n = ::write(client, buf.data(), std::min(buf.size(), total - sent));
+            if(n <= 0)
+            {
+                break;
+            }
+            sent += n;
+        }
+        ::shutdown(client, SHUT_WR);
+    });
+
+    std::vector<char> buf(256 * 1024);
+    size_t received = 0;
+    while(received < total)
+    {
+        ssize_t n = ::read(backend, buf.data(), buf.size());
+        if(n <= 0)
+        {
+            break;
+        }
+        received += n;
+    }
+    auto end = std::chrono::steady_clock::now();
+    writer.join();
+
+    double sec = std::chrono::duration<double>(end - start).count();
+    printf("  %-8s %9.1f MB/s (%zu bytes)\n", name, received / sec / 1024 / 1024, received);
+    ::close(client);
+    ::close(backend);
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t totalMb = argc > 1 ? atol(argv[1]) : 2048;
+    const int threads = argc > 2 ? atoi(argv[2]) : 2;
+
+    EventLoop loop;
+    Proxy proxy(&loop, threads);
+    proxy.start();
+
+    std::thread bench([&]() {
+        printf("relay %zu MB through the proxy, %d io threads\n", totalMb, threads);
+        proxy.setSplice(false);
+        run("copy", totalMb * 1024 * 1024);
+        proxy.setSplice(true);
+        run("splice", totalMb * 1024 * 1024);
+        loop.quit();
+    });
+
+    loop.loop();
+    bench.join();
+    return 0;
+}
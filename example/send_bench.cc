@@ -0,0 +1,145 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/TcpConnection.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/Buffer.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+* 跨线程send的吞吐：一个非loop线程不断构造消息并调用TcpConnection::send，对端用阻塞socket读
+* 每种重载都从同一个模板构造消息（各自自然的容器），比较的是转移到loop线程的代价：
+*   const std::string&   拷贝一次
+*   std::string&&        移动，不拷贝
+*   Buffer*              整个Buffer的存储移动过去，不拷贝
+*   const void*, size_t  拷贝一次
+* 默认的CMake配置没有打开优化，测之前用cmake -DCMAKE_BUILD_TYPE=Release编译mymuduo
+*/
+
+static const uint16_t kPort = 9981;
+static const size_t kMaxInFlight = 64 * 1024 * 1024;  // 发送方最多领先接收方这么多字节
+
+static std::atomic<size_t> g_received(0);
+
+static void readerThread(std::atomic<bool>* quit)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    while(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0)
+    {
+        usleep(10000);
+    }
+    std::vector<char> buf(256 * 1024);
+    while(!quit->load())
+    {
+        ssize_t n = ::read(fd, buf.data(), buf.size());
+        if(n <= 0)
+        {
+            break;
+        }
+        g_received.fetch_add(n, std::memory_order_relaxed);
+    }
+    ::close(fd);
+}
+
+template<typename Send>
+static void run(const char* name, const TcpConnectionPtr& conn, long count, size_t msgSize, Send send)
+{
+    const size_t base = g_received.load();
+    const size_t total = static_cast<size_t>(count) * msgSize;
+    auto start = std::chrono::steady_clock::now();
+    for(long i = 0; i < count; ++i)
+    {
+        while(static_cast<size_t>(i) * msgSize - (g_received.load(std::memory_order_relaxed) - base) > kMaxInFlight)
+        {
+            std::this_thread::yield();
+        }
+        send(conn);
+    }
+    auto sent = std::chrono::steady_clock::now();
+    while(g_received.load() - base < total)
+    {
+        std::this_thread::yield();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double sendNs = std::chrono::duration<double, std::nano>(sent - start).count();
+    double sec = std::chrono::duration<double>(end - start).count();
+    printf("  %-22s %9.0f msgs/s %9.1f MB/s %8.1f ns/send (caller side)\n",
+           name, count / sec, total / sec / 1024 / 1024, sendNs / count);
+}
+
+int main(int argc, char* argv[])
+{
+    const size_t msgSize = argc > 1 ? atol(argv[1]) : 4096;
+    const long count = argc > 2 ? atol(argv[2]) : 200000;
+
+    EventLoop loop;
+    TcpServer server(&loop, InetAddress(kPort), "SendBench");
+    std::shared_ptr<TcpConnection> connection;
+    std::atomic<bool> connected(false);
+    server.setConnectionCallback([&](const TcpConnectionPtr& conn) {
+        if(conn->connected())
+        {
+            connection = conn;
+            connected.store(true);
+        }
+    });
+    server.start();
+
+    std::atomic<bool> quit(false);
+    std::thread reader(readerThread, &quit);
+    std::thread producer([&]() {
+        while(!connected.load())
+        {
+            usleep(1000);
+        }
+        const std::string tpl(msgSize, 'x');
+        std::vector<char> raw(msgSize);
+        printf("message size %zu bytes, %ld messages per overload\n", msgSize, count);
+
+        run("send(const string&)", connection, count, msgSize, [&](const TcpConnectionPtr& conn) {
+            std::string msg(tpl);
+            conn->send(msg);
+        });
+        run("send(string&&)", connection, count, msgSize, [&](const TcpConnectionPtr& conn) {
+            std::string msg(tpl);
+            conn->send(std::move(msg));
+        });
+        run("send(Buffer*)", connection, count, msgSize, [&](const TcpConnectionPtr& conn) {
+            Buffer buf;
+            buf.append(tpl.data(), tpl.size());
+            conn->send(&buf);
+        });
+        run("send(const void*, len)", connection, count, msgSize, [&](const TcpConnectionPtr& conn) {
+            memcpy(raw.data(), tpl.data(), msgSize);
+            conn->send(raw.data(), raw.size());
+        });
+
+        quit.store(true);
+        connection->shutdown();
+        connection.reset();
+        loop.quit();
+    });
+
+    loop.loop();
+    producer.join();
+    reader.join();
+    return 0;
+}
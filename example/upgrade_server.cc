@@ -0,0 +1,93 @@
+#include <mymuduo/TcpServer.h>
+#include <mymuduo/TcpConnection.h>
+#include <mymuduo/EventLoop.h>
+#include <mymuduo/Buffer.h>
+#include <mymuduo/Upgrade.h>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+/*
+* 平滑升级的例子：按行回显，每行前面加上处理它的进程号
+* 用法：upgrade_server [端口] [升级用的Unix域socket路径]
+* 已经有一个upgrade_server在运行时再启动一个，新进程接过监听socket和空闲连接（包括读了半行的连接），
+* 旧进程处理完剩下的连接以后退出，客户端不会断开，之后的回显里进程号变成新进程的
+*/
+
+class LineEchoServer
+{
+public:
+    LineEchoServer(EventLoop* loop, uint16_t port, const std::string& upgradePath)
+        : loop_(loop)
+        , upgradePath_(upgradePath)
+    {
+        Upgrade::Sockets inherited;
+        if(Upgrade::receive(upgradePath, &inherited))
+        {
+            printf("pid %d took over %zu connections\n", getpid(), inherited.connections.size());
+            server_.reset(new TcpServer(loop, inherited, "UpgradeServer"));
+        }
+        else
+        {
+            server_.reset(new TcpServer(loop, InetAddress(port), "UpgradeServer"));
+        }
+        server_->setThreadNums(2);
+        server_->setConnectionCallback(std::bind(&LineEchoServer::onConnection, this, std::placeholders::_1));
+        server_->setMessageCallback(std::bind(&LineEchoServer::onMessage, this,
+            std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+        server_->setDrainedCallback(std::bind(&LineEchoServer::onDrained, this));
+    }
+
+    void start()
+    {
+        server_->start();
+        server_->enableUpgrade(upgradePath_, true);
+    }
+
+private:
+    void onConnection(const TcpConnectionPtr& conn)
+    {
+        // 交给新进程的连接在本进程中也会回调一次断开，对端其实还连着
+        printf("pid %d %s %s\n", getpid(), conn->name().c_str(),
+            conn->connected() ? "up" : (conn->handedOff() ? "handed off" : "down"));
+    }
+
+    // 只处理完整的行，半行留在inputBuffer中，升级时随连接交给新进程
+    void onMessage(const TcpConnectionPtr& conn, Buffer* buf, TimeStamp)
+    {
+        const char* eol;
+        while((eol = buf->findEOL()) != nullptr)
+        {
+            std::string line(buf->peek(), eol + 1);
+            buf->retrieve(line.size());
+            conn->send(std::to_string(getpid()) + ": " + line);
+        }
+    }
+
+    void onDrained()
+    {
+        printf("pid %d drained, exiting\n", getpid());
+        loop_->quit();
+    }
+
+    EventLoop* loop_;
+    std::string upgradePath_;
+    std::unique_ptr<TcpServer> server_;
+};
+
+int main(int argc, char* argv[])
+{
+    uint16_t port = static_cast<uint16_t>(argc > 1 ? atoi(argv[1]) : 9983);
+    std::string path = argc > 2 ? argv[2] : "/tmp/upgrade_server.sock";
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    EventLoop loop;
+    LineEchoServer server(&loop, port, path);
+    server.start();
+    loop.loop();
+    return 0;
+}